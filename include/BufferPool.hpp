@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+namespace ustacktcp {
+
+// size of every socket send/receive ring
+static constexpr size_t SOCKET_BUFFER_SIZE = 65536;
+
+// Shared pool of fixed-size socket buffers. A ring attaches a block when
+// data first flows and hands it back once drained, so an idle connection
+// holds no payload memory. Up to max_cached blocks are kept on a free list
+// for reuse; anything beyond that goes back to the heap.
+//
+// Application threads attach send rings and drain receive rings, so the
+// free list is always behind a spinlock.
+class BufferPool {
+    private:
+        struct Block {
+            Block* next_;
+        };
+
+        size_t block_size_;
+        size_t max_cached_;
+        Block* free_ = nullptr;
+        std::atomic<size_t> cached_ = 0;
+        std::atomic<size_t> live_ = 0;
+        std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+
+        void lock();
+        void unlock();
+
+    public:
+        BufferPool(size_t block_size, size_t max_cached);
+        ~BufferPool();
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+
+        std::byte* acquire();
+        void release(std::byte* block);
+
+        size_t blockSize() const;
+
+        // blocks attached to a ring right now
+        size_t live() const;
+
+        // drained blocks waiting on the free list
+        size_t cached() const;
+};
+
+}
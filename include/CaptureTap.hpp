@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <memory>
+#include <cstdio>
+
+#include <types.hpp>
+
+namespace ustacktcp {
+
+// BPF-like 4-tuple match; zero fields are wildcards. Addresses and ports
+// are in host byte order, like SocketAddr.
+struct CaptureFilter {
+    uint32_t src_ip_ = 0;
+    uint32_t dst_ip_ = 0;
+    uint16_t src_port_ = 0;
+    uint16_t dst_port_ = 0;
+    bool bidirectional_ = true;  // also match the reverse direction
+
+    bool matches(uint32_t src_ip, uint16_t src_port, uint32_t dst_ip, uint16_t dst_port) const;
+};
+
+struct CaptureOptions {
+    std::string path_;              // pcapng output file
+    CaptureFilter filter_;
+    uint32_t snaplen_ = 256;        // bytes of IP packet kept per record
+    uint32_t sample_every_ = 1;     // keep 1 of every N matching packets
+    size_t ring_slots_ = 8192;      // power of two
+};
+
+// In-engine pcapng tap. The I/O path copies matching packets into a
+// lock-free bounded MPSC ring; a background thread drains it to disk, so a
+// slow disk only ever costs dropped records, never a stalled packet path.
+class CaptureTap {
+    private:
+        struct Slot {
+            std::atomic<size_t> seq_;
+        };
+
+        struct RecordHeader {
+            uint64_t ts_ns_;
+            uint32_t orig_len_;
+            uint32_t cap_len_;
+            bool outbound_;
+        };
+
+        std::atomic<bool> enabled_ = false;
+        std::atomic<int> users_ = 0;
+
+        CaptureOptions opts_;
+        size_t slot_bytes_ = 0;
+        size_t mask_ = 0;
+        std::unique_ptr<Slot[]> slots_;
+        std::unique_ptr<std::byte[]> data_;
+        alignas(64) std::atomic<size_t> tail_ = 0;
+        alignas(64) size_t head_ = 0;
+
+        std::atomic<uint64_t> sample_ctr_ = 0;
+        std::atomic<uint64_t> captured_ = 0;
+        std::atomic<uint64_t> dropped_ = 0;
+
+        FILE* out_ = nullptr;
+        std::thread writer_;
+        std::atomic<bool> stopping_ = false;
+
+        bool push(const std::byte* ip_hdr, size_t ip_hdr_len, const std::byte* payload, size_t payload_len, bool outbound);
+        bool drainOne();
+        void writerLoop();
+        void writeHeader();
+
+    public:
+        CaptureTap() = default;
+        ~CaptureTap();
+
+        CaptureTap(const CaptureTap&) = delete;
+        CaptureTap& operator=(const CaptureTap&) = delete;
+
+        bool start(const CaptureOptions& opts);
+
+        void stop();
+
+        bool enabled() const;
+
+        // a full IPv4 packet as read from or written to the wire; outbound
+        // sets the EPB direction flag
+        void tapIPv4(const std::byte* pkt, size_t len, bool outbound);
+
+        uint64_t captured() const;
+
+        uint64_t dropped() const;
+};
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace ustacktcp {
+
+using TimePoint = std::chrono::steady_clock::time_point;
+
+// Protocol time source. Engines without one read steady_clock directly;
+// simulations inject a VirtualClock so timers follow simulated time.
+class Clock {
+    public:
+        virtual ~Clock() = default;
+
+        virtual TimePoint now() const = 0;
+};
+
+// Time only moves when the owner advances it
+class VirtualClock : public Clock {
+    private:
+        std::atomic<int64_t> ns_ = 0;
+
+    public:
+        TimePoint now() const override
+        {
+            return TimePoint(std::chrono::nanoseconds(ns_.load(std::memory_order_relaxed)));
+        }
+
+        void advanceTo(TimePoint t)
+        {
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+            if (ns > ns_.load(std::memory_order_relaxed)) ns_.store(ns, std::memory_order_relaxed);
+        }
+
+        void advance(std::chrono::nanoseconds d)
+        {
+            ns_.fetch_add(d.count(), std::memory_order_relaxed);
+        }
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include <types.hpp>
+
+namespace ustacktcp {
+
+using FastOpenKey = std::array<uint8_t, 16>;
+
+// TCP Fast Open (RFC 7413) cookies, both ends.
+//
+// Server side a cookie is a MAC of the client and server addresses under a
+// secret key (SipHash-2-4, 8 bytes), so checking one needs no state.
+// Engines serving the same address should share the key.
+//
+// Client side, cookies learned from SYN-ACKs are cached per server
+// address. The cache is consulted on connect and updated from the RX path,
+// hence the lock; neither is per packet.
+class FastOpen {
+    private:
+        uint64_t k0_;
+        uint64_t k1_;
+
+        std::mutex m_;
+        std::unordered_map<uint32_t, TCPOptions> cache_;
+        static constexpr size_t CACHE_MAX = 4096;
+        static constexpr size_t COOKIE_LEN = 8;
+
+        uint64_t mac(uint32_t client, uint32_t server) const;
+
+    public:
+        // a random key when none is given
+        explicit FastOpen(const std::optional<FastOpenKey>& key = std::nullopt);
+
+        // server: fills opts' cookie for a client
+        void cookie(TCPOptions& opts, uint32_t client, uint32_t server) const;
+
+        bool valid(const TCPOptions& opts, uint32_t client, uint32_t server) const;
+
+        // client: fills opts' cookie for server; false if none is cached
+        bool lookup(uint32_t server, TCPOptions& opts);
+
+        void store(uint32_t server, const TCPOptions& opts);
+
+        void forget(uint32_t server);
+};
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include <types.hpp>
+#include <NetDevice.hpp>
+#include <Clock.hpp>
+
+namespace ustacktcp {
+
+// Two-state burst loss model: p_ = P(good -> bad), r_ = P(bad -> good),
+// evaluated once per packet before the loss draw
+struct GilbertElliott {
+    double p_ = 0;
+    double r_ = 1;
+    double loss_good_ = 0;
+    double loss_bad_ = 1;
+};
+
+// Impairments for one direction of the link. Zero disables each knob.
+struct LinkProfile {
+    std::chrono::microseconds delay_ = std::chrono::microseconds(0);
+    std::chrono::microseconds jitter_ = std::chrono::microseconds(0); // uniform +-jitter_, keeps order
+    uint64_t rate_bps_ = 0;     // serialization rate
+    size_t queue_bytes_ = 0;    // tail-drop limit of the bottleneck queue
+    double loss_ = 0;           // independent random loss
+    GilbertElliott burst_;      // enabled when burst_.p_ > 0
+    double reorder_ = 0;        // packet skips the delay line and overtakes
+    double duplicate_ = 0;
+    double ce_mark_ = 0;        // ECT packets get CE
+};
+
+struct LinkEmulatorOptions {
+    LinkProfile tx_;
+    LinkProfile rx_;
+    uint64_t seed_ = 1;
+};
+
+struct LinkStats {
+    StatCounter passed_;
+    StatCounter lost_;
+    StatCounter queue_drops_;
+    StatCounter duplicated_;
+    StatCounter reordered_;
+    StatCounter ce_marked_;
+};
+
+// netem-style impairment stage wrapping another NetDevice. Every random
+// decision comes from a per-direction generator seeded from seed_, so the
+// same traffic sees the same losses, duplicates and reorders on every run.
+// Held packets are released by whichever thread next calls transmit() or
+// receive(); in run-to-completion mode that is at least every idle_park_,
+// and a simulation wakes the engine at nextDeadline().
+class LinkEmulator : public NetDevice {
+    private:
+        struct Held {
+            TimePoint due_;
+            uint64_t order_;
+            std::vector<std::byte> bytes_;
+
+            bool operator>(const Held& o) const
+            {
+                return due_ != o.due_ ? due_ > o.due_ : order_ > o.order_;
+            }
+        };
+
+        struct Direction {
+            LinkProfile prof_;
+            std::mt19937_64 rng_;
+            bool bad_ = false;
+            TimePoint link_free_;   // end of the last serialization
+            TimePoint last_due_;    // keeps jitter from reordering
+            size_t queued_ = 0;             // bytes waiting for the wire
+            std::priority_queue<Held, std::vector<Held>, std::greater<Held>> q_;
+            LinkStats stats_;
+
+            double uniform();
+            bool lose();
+        };
+
+        std::shared_ptr<NetDevice> inner_;
+        std::shared_ptr<Clock> clock_;
+        mutable std::mutex m_;
+        Direction tx_;
+        Direction rx_;
+        uint64_t order_ = 0;
+
+        // runs a packet through dir's impairments and queues the survivors
+        void admit(Direction& dir, const std::byte* pkt, size_t len, TimePoint now);
+
+        void flushTX(TimePoint now);
+
+        // earliest pending release, or TimePoint::max(); m_ held
+        TimePoint nextDue() const;
+
+        TimePoint clockNow() const;
+
+        // sets CE on an ECT packet and fixes the IP checksum
+        static bool markCE(std::vector<std::byte>& pkt);
+
+    public:
+        // clock may be null: steady_clock
+        LinkEmulator(std::shared_ptr<NetDevice> inner, const LinkEmulatorOptions& opts, std::shared_ptr<Clock> clock = nullptr);
+
+        ssize_t transmit(const std::byte* pkt, size_t len) override;
+
+        ssize_t receive(std::byte* buf, size_t len, bool nonblock) override;
+
+        int pollFd() const override;
+
+        void setBusyPoll(std::chrono::microseconds budget) override;
+
+        bool setFilter(const RxFilter& filter) override;
+
+        TimePoint nextDeadline() const override;
+
+        const LinkStats& txStats() const;
+
+        const LinkStats& rxStats() const;
+};
+
+}
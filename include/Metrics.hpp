@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ustacktcp {
+
+// Counter that may be bumped from several threads (threaded engine mode)
+struct MetricCounter {
+    std::atomic<uint64_t> v_ = 0;
+
+    void add(uint64_t n = 1) { v_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const { return v_.load(std::memory_order_relaxed); }
+};
+
+// HDR-style log-linear histogram of nanosecond values: 16 linear
+// sub-buckets per power of two, i.e. ~6% relative error over the full
+// uint64_t range, with a fixed 8 KB footprint and no allocation.
+class LatencyHistogram {
+    private:
+        static constexpr int SUB_BITS = 4;
+        static constexpr size_t SUB_COUNT = 1 << SUB_BITS;
+        static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+        std::atomic<uint64_t> counts_[BUCKETS] = {};
+        MetricCounter total_;
+        MetricCounter sum_;
+        std::atomic<uint64_t> max_ = 0;
+
+        static size_t bucketOf(uint64_t v);
+        static uint64_t bucketUpper(size_t idx);
+
+    public:
+        void record(uint64_t ns);
+
+        void record(std::chrono::steady_clock::duration d);
+
+        uint64_t count() const;
+        uint64_t sum() const;
+        uint64_t max() const;
+
+        // upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+        uint64_t percentile(double p) const;
+};
+
+enum DropReason : uint8_t {
+    DROP_NOT_TCP,
+    DROP_BAD_VERSION,
+    DROP_FOREIGN_PORT,
+    DROP_NO_SOCKET,
+    DROP_FSM_REJECT,
+    DROP_TIME_WAIT,     // absorbed by a TIME_WAIT entry
+    DROP_RX_ERROR,
+    DROP_TX_ERROR,
+    DROP_REASON_COUNT
+};
+
+const char* dropReasonName(DropReason r);
+
+struct EngineMetrics {
+    MetricCounter packets_in_;
+    MetricCounter bytes_in_;
+    MetricCounter packets_out_;
+    MetricCounter bytes_out_;
+    MetricCounter drops_[DROP_REASON_COUNT];
+    MetricCounter retransmits_;
+    MetricCounter timer_fires_;
+    MetricCounter segment_allocs_;  // descriptors taken from the segment pool
+    MetricCounter sockets_reclaimed_;  // closed sockets dropped by the engine
+    MetricCounter time_wait_reuses_;   // TIME_WAIT tuples taken over early
+    MetricCounter fast_path_;          // segments handled by header prediction
+    MetricCounter rx_coalesced_;       // segments merged into an earlier one
+    MetricCounter gso_packets_;        // packets cut from super-segments in software
+    MetricCounter window_updates_;     // ACKs sent because the reader opened the window
+    MetricCounter window_probes_;      // zero-window probes sent by the persist timer
+    MetricCounter oow_acks_;           // ACKs answering unacceptable segments
+    MetricCounter fast_open_accepted_; // SYNs whose data was taken on a valid cookie
+    MetricCounter fast_open_cookies_;  // Fast Open cookies handed out in SYN-ACKs
+    MetricCounter fast_open_fallbacks_; // SYN data the peer did not take, sent again
+    MetricCounter file_bytes_;         // bytes queued by sendFile()
+    MetricCounter file_chunks_;        // file windows mapped to send from
+
+    LatencyHistogram rx_process_ns_;    // per-packet processPacket() time
+    LatencyHistogram send_to_wire_ns_;  // application send() to first transmission
+    LatencyHistogram wire_to_recv_ns_;  // packet arrival to application recv()
+
+    std::string toPrometheus() const;
+    std::string toJSON() const;
+};
+
+enum class MetricsFormat {
+    PROMETHEUS,
+    JSON
+};
+
+enum class MetricsSink {
+    FILE,         // rewritten atomically (write + rename) on every snapshot
+    UNIX_SOCKET   // each snapshot is pushed over a new stream connection
+};
+
+struct MetricsExportOptions {
+    std::string path_;  // export disabled when empty
+    MetricsFormat format_ = MetricsFormat::PROMETHEUS;
+    MetricsSink sink_ = MetricsSink::FILE;
+    std::chrono::milliseconds interval_ = std::chrono::seconds(10);
+};
+
+// Periodic exporter; the thread started by start() is stopped and joined
+// on destruction, before the metrics it reads go away.
+class MetricsExporter {
+    private:
+        const EngineMetrics& metrics_;
+        MetricsExportOptions opts_;
+
+        std::atomic<bool> stop_ = false;
+        std::mutex m_;
+        std::condition_variable cv_;  // cuts the interval sleep short on stop
+        std::thread thread_;
+
+        bool writeFile(const std::string& body) const;
+        bool writeSocket(const std::string& body) const;
+        void exportLoop();
+
+    public:
+        MetricsExporter(const EngineMetrics& metrics, const MetricsExportOptions& opts);
+        ~MetricsExporter();
+
+        MetricsExporter(const MetricsExporter&) = delete;
+        MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+        bool exportOnce() const;
+
+        // exports every interval_ until destroyed
+        void start();
+};
+
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#include <types.hpp>
+#include <Clock.hpp>
+
+namespace ustacktcp {
+
+// Local endpoints a device should deliver traffic for: any port in ports_
+// on any address in addrs_. Past a size limit the lists widen (a port
+// range, or any address), so a filter may admit more than was bound but
+// never less.
+struct RxFilter {
+    std::vector<uint32_t> addrs_;   // sorted; empty admits any address
+    std::vector<uint16_t> ports_;   // sorted
+    bool port_range_ = false;       // admit ports_.front() .. ports_.back()
+
+    static RxFilter build(const std::vector<SocketAddr>& local, size_t max_addrs, size_t max_ports);
+
+    bool covers(const SocketAddr& addr) const;
+};
+
+// Packet I/O backend underneath TCPEngine
+class NetDevice {
+    public:
+        virtual ~NetDevice() = default;
+
+        // pkt is a complete IPv4 packet, headers built by the engine
+        virtual ssize_t transmit(const std::byte* pkt, size_t len) = 0;
+
+        // Reads one IPv4 packet. With nonblock set, returns -1 and sets
+        // errno to EAGAIN when nothing is queued.
+        virtual ssize_t receive(std::byte* buf, size_t len, bool nonblock) = 0;
+
+        // fd that polls readable when receive() has data, or -1
+        virtual int pollFd() const = 0;
+
+        // Largest TCP payload transmit() takes in one packet and cuts into
+        // MSS-sized ones itself (TSO). 0: every packet must fit the MTU,
+        // the engine splits larger segments.
+        virtual size_t maxSegment() const { return 0; }
+
+        virtual void setBusyPoll(std::chrono::microseconds) {}
+
+        // Narrows receive() to traffic for filter, replacing any previous
+        // one. Returns false when the device cannot filter.
+        virtual bool setFilter(const RxFilter&) { return false; }
+
+        // earliest time the device will have something to deliver or
+        // transmit without further input (held packets), or TimePoint::max()
+        virtual TimePoint nextDeadline() const { return TimePoint::max(); }
+};
+
+// SOCK_RAW/IPPROTO_TCP with IP_HDRINCL: sees every TCP packet on the
+// host and sends our IP header as is (the kernel still fills in the IP
+// checksum). setFilter() compiles a classic BPF
+// program and attaches it to the socket, so the kernel drops other
+// applications' traffic before it is copied to us.
+class RawSocketDevice : public NetDevice {
+    private:
+        int fd_;
+        bool filtered_ = false;
+
+    public:
+        RawSocketDevice();
+        ~RawSocketDevice();
+
+        ssize_t transmit(const std::byte* pkt, size_t len) override;
+
+        ssize_t receive(std::byte* buf, size_t len, bool nonblock) override;
+
+        int pollFd() const override;
+
+        void setBusyPoll(std::chrono::microseconds budget) override;
+
+        bool setFilter(const RxFilter& filter) override;
+};
+
+// One end of an in-process, thread-safe link between two engines.
+// transmit() queues the packet at the peer; a full queue drops, like a
+// NIC ring.
+class PipeDevice : public NetDevice {
+    private:
+        struct Queue {
+            std::mutex m_;
+            std::deque<std::vector<std::byte>> q_;
+            int efd_ = -1;   // readable while q_ is non-empty
+
+            ~Queue();
+        };
+
+        std::shared_ptr<Queue> rx_;
+        std::shared_ptr<Queue> tx_;
+        size_t limit_;
+        StatCounter drops_;
+
+        PipeDevice(std::shared_ptr<Queue> rx, std::shared_ptr<Queue> tx, size_t limit);
+
+    public:
+        static std::pair<std::shared_ptr<PipeDevice>, std::shared_ptr<PipeDevice>> makePair(size_t queue_packets = 4096);
+
+        ssize_t transmit(const std::byte* pkt, size_t len) override;
+
+        ssize_t receive(std::byte* buf, size_t len, bool nonblock) override;
+
+        int pollFd() const override;
+
+        uint64_t drops() const;
+};
+
+}
\ No newline at end of file
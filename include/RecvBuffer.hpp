@@ -4,40 +4,103 @@
 #include <cstdint>
 #include <stddef.h>
 #include <sys/types.h>
-#include <map>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <optional>
 
 #include <types.hpp>
+#include <SPSCRing.hpp>
+#include <BufferPool.hpp>
 
 namespace ustacktcp {
 
+// Bytes are stored at their sequence position, so the engine (producer)
+// can place out-of-order data directly and the application (consumer) reads
+// a plain FIFO up to the in-order edge. The ring's block is attached when
+// payload arrives and returned once the reader drains it.
 class RecvBuffer {
     private:
-        std::byte* buf_;
-        static constexpr size_t sz_ = 65535; // FIXME: hardcoded max size
-        size_t tail_;
-        size_t head_;
-        uint32_t ack_;
+        static constexpr size_t sz_ = SOCKET_BUFFER_SIZE;
+        SPSCByteRing ring_;
+        uint32_t ack_ = 0;
+        uint32_t fin_seq_ = 0;
+        bool fin_pending_ = false;
+        bool fin_rcvd_ = false;
 
-        std::map<uint32_t, std::shared_ptr<TCPSegment>, TCPSegmentMapCompare> q_;
+        // out-of-order ranges [start, end) already copied into ring_, sorted
+        // and disjoint. Fixed capacity so the receive path never allocates;
+        // a segment that would need one more range is dropped and comes back
+        // as a retransmission. The ring stays held while any are queued.
+        static constexpr size_t MAX_OOO_RANGES = 16;
+        struct Range {
+            uint32_t start_;
+            uint32_t end_;
+        };
+        Range q_[MAX_OOO_RANGES];
+        size_t q_len_ = 0;
 
-        size_t getSize() const;
-        size_t getAvailSize() const;
+        StatCounter stat_bytes_received_;
+
+        // wire-to-recv latency sampling: the engine marks the ring position
+        // ending a delivery, the reader takes the sample once it passes it
+        std::atomic<size_t> rx_mark_pos_ = 0;
+        std::atomic<int64_t> rx_mark_ns_ = 0;
+
+        // ring position of the right window edge last advertised, written
+        // by whichever thread sends; the reader compares it with the room
+        // its reads have freed
+        std::atomic<size_t> adv_edge_ = 0;
+
+        bool insertRange(uint32_t s, uint32_t e);
+
+        // publishes the in-order bytes up to new_ack, written at tail on
+        void advance(size_t tail, uint32_t new_ack);
 
     public:
-        RecvBuffer();
+        explicit RecvBuffer(BufferPool* pool = nullptr);
 
         void setIRS(const uint32_t irs);
 
         ssize_t enqueue(const std::byte* data, const size_t len, const uint32_t seq_num, const uint8_t flags);
 
+        // Header prediction: len bytes at seq_num are exactly the next ones
+        // expected, fit the window, and nothing is queued out of order
+        bool inSequence(const uint32_t seq_num, const size_t len) const;
+
+        // appends bytes that passed inSequence()
+        void append(const std::byte* data, const size_t len);
+
         ssize_t dequeue(std::byte* dest, const size_t len);
 
+        // Splicing (see splice()): the engine reads the ring in place where
+        // the application would dequeue(), and releases bytes once the
+        // other connection's peer acks them
+        const SPSCByteRing& ring() const;
+        void release(const size_t len);
+
+        // the peer's FIN is in, and so is everything before it
+        bool finReceived() const;
+
         uint32_t getAckNumber() const;
 
-        bool availableData();
+        bool availableData() const;
+
+        // Reader side: latency of the sampled delivery once fully dequeued
+        std::optional<std::chrono::steady_clock::duration> takeLatencySample();
 
         uint16_t getWindowSize() const;
+
+        // getWindowSize() for an outgoing segment, remembered as advertised
+        uint16_t advertiseWindow();
+
+        // Reader side: the window has opened enough past the advertised one
+        // to be worth an update. Receiver SWS avoidance (RFC 1122 4.2.3.3):
+        // only once the peer is down to half of it and the increase is at
+        // least min(buffer / 2, MSS).
+        bool windowUpdateDue() const;
+
+        void fillInfo(TCPInfo& info) const;
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace ustacktcp {
+
+// Multi-producer queue drained in batches by a single consumer. Producers pay
+// a lock per push; the consumer only locks when the queue is non-empty and
+// swaps the whole batch out at once.
+template <typename T>
+class RequestQueue {
+    private:
+        std::mutex m_;
+        std::vector<T> q_;
+        std::atomic<size_t> sz_ = 0;
+
+    public:
+        void push(T&& v)
+        {
+            std::lock_guard lock(m_);
+            q_.push_back(std::move(v));
+            sz_.store(q_.size(), std::memory_order_release);
+        }
+
+        // out must be empty; returns the number of drained entries
+        size_t drain(std::vector<T>& out)
+        {
+            if (sz_.load(std::memory_order_acquire) == 0) return 0;
+            std::lock_guard lock(m_);
+            out.swap(q_);
+            sz_.store(0, std::memory_order_release);
+            return out.size();
+        }
+
+        bool empty() const
+        {
+            return sz_.load(std::memory_order_acquire) == 0;
+        }
+};
+
+}
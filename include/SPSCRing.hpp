@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+namespace ustacktcp {
+
+class BufferPool;
+
+// Lock-free single-producer/single-consumer byte ring. Positions are
+// monotonic byte counters; the producer owns tail_, the consumer owns head_.
+//
+// Storage is attached on demand: the producer attaches a block (from pool_
+// when set) before it first writes, and whichever side sees the ring empty
+// hands it back with trim(). The producer marks the block HELD while it may
+// be writing, including unpublished bytes it keeps past the tail, and
+// trim() leaves a held block alone. trim() in turn marks the block
+// TRIMMING while it re-checks that the ring is empty, and hold() waits for
+// that to settle. The consumer only dereferences the buffer while
+// readable() > 0, so nothing it reads can be detached.
+class SPSCByteRing {
+    private:
+        static constexpr uintptr_t HELD = 1;
+        static constexpr uintptr_t TRIMMING = 2;
+
+        std::atomic<uintptr_t> buf_ = 0; // block address | HELD | TRIMMING
+        BufferPool* pool_;
+        size_t cap_;  // power of two
+        size_t mask_;
+
+        // kept on one line: an idle connection is two of these
+        std::atomic<size_t> head_ = 0;
+        std::atomic<size_t> tail_ = 0;
+
+        std::byte* block() const;
+
+    public:
+        explicit SPSCByteRing(size_t cap, BufferPool* pool = nullptr);
+        ~SPSCByteRing();
+
+        SPSCByteRing(const SPSCByteRing&) = delete;
+        SPSCByteRing& operator=(const SPSCByteRing&) = delete;
+
+        size_t capacity() const;
+
+        // true while a block is attached
+        bool attached() const;
+
+        // producer side; writeAt() requires the block to be held
+        size_t writable() const;
+        size_t write(const std::byte* data, size_t len);
+        void hold();
+        void unhold();
+        void writeAt(size_t pos, const std::byte* data, size_t len);
+        void publish(size_t tail);
+
+        // consumer side
+        size_t readable() const;
+        size_t read(std::byte* dest, size_t len);
+        void release(size_t n);
+
+        // either side: detaches the block if the ring is empty and not held
+        bool trim();
+
+        size_t head() const;
+        size_t tail() const;
+
+        // Direct access for building segments out of ring memory. A range
+        // starting at pos is contiguous for contiguous(pos) bytes and then
+        // continues at data().
+        const std::byte* at(size_t pos) const;
+        const std::byte* data() const;
+        size_t contiguous(size_t pos) const;
+};
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ustacktcp {
+
+// Software GRO over one RX batch. In-order data segments of one flow are
+// merged into a single IPv4 packet, so the protocol sees one segment, one
+// receive-buffer insert, one wakeup and sends one ACK for the lot.
+//
+// Only plain ACK (+PSH) segments with payload, no IP options and no
+// fragmentation take part. A segment extends the held one when it has the
+// same addresses, ports, TOS, ACK number and TCP options and starts where
+// the held payload ends; the merged packet carries the newest window.
+// PSH does not end a run: received data is readable at once either way,
+// and senders (this one included) set it on every segment. Checksums are
+// left stale, the engine does not verify them.
+class SegmentCoalescer {
+    private:
+        std::vector<std::byte> pkt_;  // held packet, capacity fixed at 64KB
+        size_t len_ = 0;
+        size_t segs_ = 0;
+        size_t hdr_len_ = 0;          // IP + TCP header of the held packet
+        uint32_t next_seq_ = 0;       // host order
+
+        static bool eligible(const std::byte* pkt, size_t len);
+        bool extends(const std::byte* pkt, size_t len) const;
+
+    public:
+        SegmentCoalescer();
+
+        // Holds pkt or merges it into the held packet. False when pkt cannot
+        // join: flush the held packet, then add() again or process pkt as is.
+        bool add(const std::byte* pkt, size_t len);
+
+        bool empty() const;
+
+        const std::byte* data() const;
+        size_t size() const;
+
+        // wire segments in the held packet
+        size_t segments() const;
+
+        void clear();
+};
+
+}
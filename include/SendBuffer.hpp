@@ -8,31 +8,40 @@
 #include <vector>
 #include <chrono>
 #include <memory>
+#include <mutex>
+#include <deque>
 
 #include <types.hpp>
+#include <SPSCRing.hpp>
+#include <BufferPool.hpp>
 
 namespace ustacktcp {
 
 class TCPEngine;
 class RecvBuffer;
+class StreamSocket;
 
 class SendBuffer {
     private:
-        std::byte* buf_;
-        static constexpr size_t sz_ = 65535; // FIXME: hardcoded max size
-        size_t head_;
-        size_t tail_;
+        static constexpr size_t sz_ = SOCKET_BUFFER_SIZE; // FIXME: hardcoded max size
+        SPSCByteRing ring_;  // payload bytes; producer is the application, block from the engine's pool
+        size_t seg_pos_ = 0; // ring position of the first byte not yet segmented
         uint32_t next_seq_num_ = 100; //FIXME: hardcoded iss
         uint32_t ack_num_ = 100;
         
-        std::priority_queue<std::shared_ptr<TCPSegment>, std::vector<std::shared_ptr<TCPSegment>>, TCPSegmentHeapCompare> in_flight_q_;
-        std::priority_queue<std::shared_ptr<TCPSegment>, std::vector<std::shared_ptr<TCPSegment>>, TCPSegmentHeapCompare> next_q_;
+        // segment descriptors come from the engine's pool
+        SegmentList in_flight_q_;
+        SegmentList next_q_;
 
         std::chrono::steady_clock::time_point to_expiry_;
-        std::chrono::steady_clock::duration srtt_;
-        std::chrono::steady_clock::duration rttvar_;
-        std::chrono::steady_clock::duration rto_;
-        bool rtt_init_;
+        std::chrono::steady_clock::duration srtt_{};
+        std::chrono::steady_clock::duration rttvar_{};
+        std::chrono::steady_clock::duration rto_ = INITIAL_RTO;
+        bool rtt_init_ = false;
+        // persist timer, see persistArmed()
+        std::chrono::steady_clock::time_point persist_expiry_;
+        std::chrono::steady_clock::duration persist_backoff_{};
+        bool persist_armed_ = false;
         static constexpr std::chrono::steady_clock::duration INITIAL_RTO = std::chrono::milliseconds(200); 
         static constexpr std::chrono::steady_clock::duration RTO_MIN     = std::chrono::milliseconds(200);  
         static constexpr std::chrono::steady_clock::duration RTO_MAX     = std::chrono::seconds(60);
@@ -44,50 +53,209 @@ class SendBuffer {
         
         TCPEngine& engine_;
         RecvBuffer& recv_buf_;
+        StreamSocket* owner_;  // whose timer restartRTO() arms; may be null
         SocketAddr local_addr_;
         SocketAddr peer_addr_;
+        PacketTemplate tmpl_;  // rebuilt whenever either address changes
+
+        // Fast Open: options for our SYN or SYN-ACK. A client SYN with a
+        // cookie carries the first MSS of queued data (syn_data_ until the
+        // SYN is acked); data the peer did not take goes again at once.
+        TCPOptions syn_opts_;
+        bool syn_data_ = false;
+        bool syn_data_rejected_ = false;
+
+        // sendFile(): a file goes out after the ring bytes written before
+        // it, from a read-only mapping of the window the sender has reached.
+        // A window is twice the send window (readahead covers the one after
+        // it), mapped once the previous one is all queued and unmapped once
+        // acked, so a transfer holds a window or two however large the file
+        // is.
+        struct FileSpan {
+            size_t ring_pos_;  // ring bytes before this position go first
+            int fd_;           // our own dup
+            off_t off_;
+            size_t len_;
+        };
+        struct MappedChunk {
+            std::byte* map_;
+            size_t map_len_;
+            size_t unacked_;   // payload bytes segmented from it, not yet acked
+        };
+        std::mutex files_m_;                 // the application queues, the engine takes
+        std::deque<FileSpan> files_;
+        std::atomic<size_t> files_queued_ = 0;
+        FileSpan file_{0, -1, 0, 0};         // being segmented, fd_ -1 if none
+        std::deque<MappedChunk> chunks_;     // in sequence order
+        uint8_t fin_flags_ = 0;              // a FIN waiting for the file before it
+        static constexpr size_t FILE_CHUNK_MIN = 256 * 1024;
+        static constexpr size_t FILE_CHUNK_MAX = 4 * 1024 * 1024;
+
+        // splice(): bytes received on splice_src_, segmented in place from
+        // its receive ring after everything queued here
+        StreamSocket* splice_src_ = nullptr;
+        size_t splice_pos_ = 0;  // its ring position of the first byte not yet segmented
+
+        // bytes of ring from pos up to stop
+        void segmentRing(const SPSCByteRing& ring, size_t& pos, size_t stop, PayloadSource source, size_t mark);
+        // ring bytes and files in the order they were queued, spliced
+        // bytes, then a pending FIN; a file only as far as its next window
+        void segmentQueued(size_t mark);
+        // maps and segments file_'s next window; on failure the file is
+        // dropped and the connection aborted
+        bool mapChunk();
+        // n payload bytes of seg acked or dropped
+        void releasePayload(const TCPSegment* seg, size_t n);
         
-        static constexpr size_t MSS = 1460;
+        static constexpr size_t MSS = TCP_MSS;
+        // Data is queued in super-segments of up to seg_max_ bytes, cut at
+        // MSS multiples where the window or a retransmission needs less.
+        size_t seg_max_;
         static constexpr size_t INIT_SSTHRESH = 64*1024;
         static constexpr size_t INIT_CWND = 2*MSS;
         
         size_t in_flight_sz_ = 0;
         size_t rcvwnd_ = 0;
+        size_t max_rcvwnd_ = 0;  // largest window the peer offered, Max(SND.WND)
+        // segment that last set rcvwnd_ (SND.WL1, SND.WL2)
+        uint32_t wnd_seq_ = 0;
+        uint32_t wnd_ack_ = 0;
+        bool wnd_set_ = false;
         size_t ssthresh_ = INIT_SSTHRESH;
         size_t cwnd_ = INIT_CWND;
 
+        // Statistics: written only by the thread driving this buffer. Gauges
+        // are mirrored after each update so getInfo() needs no lock.
+        enum SendLimit : uint8_t { NOT_LIMITED, RWND_LIMITED, CWND_LIMITED };
+        SendLimit limit_ = NOT_LIMITED;
+        std::chrono::steady_clock::time_point limit_since_;
+        StatCounter stat_limit_;
+        StatCounter stat_limit_since_ns_;
+        StatCounter stat_rwnd_limited_ns_;
+        StatCounter stat_cwnd_limited_ns_;
+        StatCounter stat_bytes_sent_;
+        StatCounter stat_bytes_retrans_;
+        StatCounter stat_bytes_acked_;
+        StatCounter stat_retrans_;
+        StatCounter stat_dup_acks_;
+        StatCounter stat_srtt_us_;
+        StatCounter stat_rttvar_us_;
+        StatCounter stat_rto_us_;
+        StatCounter stat_cwnd_;
+        StatCounter stat_ssthresh_;
+        StatCounter stat_in_flight_;
+        StatCounter stat_rcvwnd_;
+
+        // send-to-wire latency sampling, one mark outstanding at a time: the
+        // writer publishes the ring position ending its write, pump() turns
+        // it into a sequence number and sendSegments() records the latency
+        // when that byte first hits the wire.
+        std::atomic<size_t> tx_mark_pos_ = 0;
+        std::atomic<int64_t> tx_mark_ns_ = 0;
+        bool tx_mark_armed_ = false;
+        uint32_t tx_mark_seq_ = 0;
+
+        void setLimit(SendLimit limit, const std::chrono::steady_clock::time_point now);
+        void publishGauges();
+
 
         void updateCwnd(const size_t bytes_acked);
         bool canSend(const size_t n) const;
         
-        bool isFull() const;
-        bool isEmpty() const;
-        size_t getSize() const;
-        size_t getAvailSize() const;
-
         void rttSample(const std::chrono::steady_clock::duration);
         void restartRTO();
 
-        void sendSegments();
+        // Sends what the window takes in whole MSS units. A window smaller
+        // than that is used when it is at least half the largest the peer
+        // offered, or when the persist timer overrides (RFC 1122 4.2.3.4).
+        void sendSegments(bool force = false);
+        void sendSyn(TCPSegment* syn);
+
+        // splits p after at bytes; the tail follows it in q
+        void splitSegment(SegmentList& q, TCPSegment* p, size_t at);
 
     public:
-        SendBuffer(TCPEngine&, RecvBuffer&);
+        SendBuffer(TCPEngine&, RecvBuffer&, StreamSocket* owner = nullptr);
+        ~SendBuffer();
+
+        SendBuffer(const SendBuffer&) = delete;
+        SendBuffer& operator=(const SendBuffer&) = delete;
 
         void setLocalAddr(const SocketAddr&);
 
         void setPeerAddr(const SocketAddr&);
 
+        const PacketTemplate& headerTemplate() const;
+
+        void setSynOptions(const TCPOptions& opts);
+
+        // sends what src receives from its ring position pos on; null stops
+        void setSpliceSource(StreamSocket* src, size_t pos);
+
+        // the SYN-ACK acked our SYN but not the data sent with it
+        bool synDataRejected() const;
+
         void setRcvWnd(const uint16_t rcvwnd);
 
+        // setRcvWnd() on a synchronized connection, from a segment with
+        // seq and ack: a window that grew sends what waited on it
+        void windowUpdate(const uint16_t rcvwnd, const uint32_t seq, const uint32_t ack);
+
+        // snd_nxt, for ACKs: queued bytes the window holds back do not
+        // count, or an ACK would fall outside a peer window kept small
         const uint32_t getSeqNumber() const;
 
+        // before the SYN only
+        void setISS(const uint32_t iss);
+
         ssize_t enqueue(const std::byte* data, size_t len, const uint8_t flags);
 
+        // Application side: publishes bytes without transmitting them.
+        size_t write(const std::byte* data, size_t len);
+
+        size_t writable() const;
+
+        // Application side: queues len bytes of fd from offset to go out
+        // after what write() published so far, without copying them. The
+        // file must not shrink before it is sent. Returns len, or -1 if fd
+        // cannot be used or holds fewer bytes.
+        ssize_t writeFile(int fd, off_t offset, size_t len);
+
+        size_t capacity() const;
+
+        // Engine side: segments published bytes, appends a SYN/FIN segment
+        // if ctrl_flags carries one, and transmits what the windows allow.
+        // A FIN follows any file still being sent.
+        void pump(const uint8_t ctrl_flags = 0);
+
+        // ack_num lies within [snd_una, snd_nxt]
+        bool ackAcceptable(const uint32_t ack_num) const;
+
         void handleACK(const uint32_t ack_num, const std::chrono::steady_clock::time_point ack_timestmp);
 
-        void handleRTO();
+        // Returns true if a segment was retransmitted
+        bool handleRTO();
 
         std::chrono::steady_clock::time_point getRTOExpiry() const;
+
+        bool rtoArmed() const;
+
+        // Persist timer: armed while data waits on a window too small for
+        // it and nothing is in flight whose ACK could reopen it. An expiry
+        // sends what fits in an open window below one MSS; a closed window
+        // gets a zero-window probe and the interval doubles, from the RTO up
+        // to RTO_MAX.
+        bool persistArmed() const;
+
+        std::chrono::steady_clock::time_point getPersistExpiry() const;
+
+        // Returns true if a probe or data was sent
+        bool handlePersist();
+
+        // everything queued, FIN included, has been sent and acked
+        bool drained() const;
+
+        void fillInfo(TCPInfo& info) const;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <Clock.hpp>
+#include <NetDevice.hpp>
+#include <TCPEngine.hpp>
+
+namespace ustacktcp {
+
+// One end of an in-memory point-to-point link. transmit() appends the
+// packet to the peer's inbox; delay and loss come from
+// EngineOptions::link_emulator_ on either engine.
+class SimDevice : public NetDevice {
+    private:
+        std::deque<std::vector<std::byte>> inbox_;
+        SimDevice* peer_ = nullptr;
+
+        friend class Simulator;
+
+    public:
+        ssize_t transmit(const std::byte* pkt, size_t len) override;
+
+        ssize_t receive(std::byte* buf, size_t len, bool nonblock) override;
+
+        int pollFd() const override;
+};
+
+// Discrete-event driver for run-to-completion engines sharing one
+// VirtualClock. Engines are polled until quiescent, then the clock jumps
+// straight to the earliest scheduled event, RTO, TIME_WAIT expiry or held
+// packet. Everything runs on the calling thread, so a given scenario
+// replays identically; use the socket's Async/try* calls from events.
+class Simulator {
+    private:
+        struct Event {
+            TimePoint at_;
+            uint64_t order_;
+            std::function<void()> fn_;
+
+            bool operator>(const Event& o) const
+            {
+                return at_ != o.at_ ? at_ > o.at_ : order_ > o.order_;
+            }
+        };
+
+        std::shared_ptr<VirtualClock> clock_;
+        std::vector<std::unique_ptr<TCPEngine>> engines_;
+        std::vector<std::shared_ptr<SimDevice>> devices_;
+        std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+        uint64_t order_ = 0;
+        uint64_t steps_ = 0;
+
+        size_t settle();
+
+    public:
+        Simulator();
+
+        // Two engines joined by an in-memory link. mode_, device_ and clock_
+        // are overridden; everything else, including link_emulator_, is kept.
+        std::pair<TCPEngine*, TCPEngine*> addLink(EngineOptions a = EngineOptions(), EngineOptions b = EngineOptions());
+
+        TimePoint now() const;
+
+        void at(TimePoint t, std::function<void()> fn);
+
+        void after(std::chrono::nanoseconds d, std::function<void()> fn);
+
+        // Advances until end, or until pred() holds when given; returns
+        // pred() (false without one). Stops early when nothing is pending.
+        bool runUntil(TimePoint end, const std::function<bool()>& pred = nullptr);
+
+        bool runFor(std::chrono::nanoseconds d, const std::function<bool()>& pred = nullptr);
+
+        // clock jumps taken so far
+        uint64_t steps() const;
+};
+
+}
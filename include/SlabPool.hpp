@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <types.hpp>
+
+namespace ustacktcp {
+
+// Fixed-size object pool carved out of slabs of SLAB objects. Released
+// objects go on an intrusive free list and are reused LIFO (cache-warm), so
+// once the pool reaches its high-water mark the hot path stops touching the
+// heap. Slabs are only returned when the pool is destroyed.
+//
+// Meant to be owned by the engine and used from its loop thread; in
+// threaded mode setShared(true) puts a spinlock around the free list.
+template <typename T, size_t SLAB = 256>
+class SlabPool {
+    private:
+        union Slot {
+            Slot* next_;
+            alignas(T) std::byte obj_[sizeof(T)];
+        };
+
+        std::vector<std::unique_ptr<Slot[]>> slabs_;
+        Slot* free_ = nullptr;
+        size_t live_ = 0;
+        bool shared_ = false;
+        std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+
+        void grow()
+        {
+            slabs_.push_back(std::make_unique<Slot[]>(SLAB));
+            Slot* slab = slabs_.back().get();
+            for (size_t i = 0; i < SLAB; i++)
+            {
+                slab[i].next_ = free_;
+                free_ = &slab[i];
+            }
+        }
+
+        void lock()
+        {
+            if (!shared_) return;
+            while (lock_.test_and_set(std::memory_order_acquire)) cpuRelax();
+        }
+
+        void unlock()
+        {
+            if (shared_) lock_.clear(std::memory_order_release);
+        }
+
+    public:
+        explicit SlabPool(size_t reserve = 0)
+        {
+            while (capacity() < reserve) grow();
+        }
+
+        SlabPool(const SlabPool&) = delete;
+        SlabPool& operator=(const SlabPool&) = delete;
+
+        void setShared(bool shared) { shared_ = shared; }
+
+        template <typename... Args>
+        T* acquire(Args&&... args)
+        {
+            lock();
+            if (!free_) grow();
+            Slot* s = free_;
+            free_ = s->next_;
+            live_++;
+            unlock();
+            return new (s->obj_) T(std::forward<Args>(args)...);
+        }
+
+        void release(T* obj)
+        {
+            obj->~T();
+            Slot* s = reinterpret_cast<Slot*>(obj);
+            lock();
+            s->next_ = free_;
+            free_ = s;
+            live_--;
+            unlock();
+        }
+
+        size_t live() const { return live_; }
+
+        size_t capacity() const { return slabs_.size() * SLAB; }
+};
+
+}
@@ -7,6 +7,8 @@
 #include <map>
 #include <chrono>
 #include <optional>
+#include <atomic>
+#include <memory>
 
 #include <types.hpp>
 #include <SendBuffer.hpp>
@@ -25,25 +27,108 @@ class StreamSocket : public std::enable_shared_from_this<StreamSocket> {
 
         SocketAddr _local_addr;
         SocketAddr _peer_addr;
-
-        std::mutex m_;
-        std::condition_variable cv_;
-
-        std::chrono::steady_clock::time_point time_wait_expiry_;
-        static constexpr std::chrono::steady_clock::duration time_wait_to_ = std::chrono::seconds(60);
-
-        void setTimeWaitExipiry();
-        void timeWaitTO();
+        bool bind_ok_ = false;
+        bool closed_ = false;  // went back to CLOSED; the engine may reclaim it
+        bool fast_open_ = false;  // connecting with Fast Open
+
+        // splice(): what we receive goes out on splice_dst_ from our ring,
+        // and a socket spliced into holds on to its splice_src_ while its
+        // segments point there. Whichever end reaches CLOSED first unlinks
+        // both, so a dead destination is never pumped.
+        std::shared_ptr<StreamSocket> splice_dst_;
+        std::shared_ptr<StreamSocket> splice_src_;
+        bool splice_ok_ = false;
+        bool splice_fin_ = false;  // our peer's FIN was passed on
+
+        // threaded mode blocks on a condvar; allocated only in that mode to
+        // keep the control block small
+        struct Waiter {
+            std::mutex m_;
+            std::condition_variable cv_;
+        };
+        std::unique_ptr<Waiter> wait_;
+
+        // run-to-completion mode: the application and the loop thread share
+        // the buffers as SPSC rings. The loop thread bumps events_ on state
+        // changes and when a blocked reader/writer crosses its watermark.
+        std::atomic<uint32_t> events_ = 0;
+        std::atomic<bool> rx_waiting_ = false;
+        std::atomic<bool> tx_waiting_ = false;
+        std::atomic<bool> tx_armed_ = false;  // doorbell already rung
+        std::atomic<bool> wnd_armed_ = false; // window update already requested
+        static constexpr size_t tx_lowat_ = 16 * 1024;
+
+        // busy-poll receive: recv() spins for up to busy_poll_budget_ before
+        // sleeping. The budget doubles on a hit and halves on a miss, bounded
+        // by the opted-in maximum.
+        std::chrono::nanoseconds busy_poll_max_ = std::chrono::nanoseconds(0);
+        std::chrono::nanoseconds busy_poll_budget_ = std::chrono::nanoseconds(0);
+        StatCounter spin_hits_;
+        StatCounter spin_sleeps_;
+
+        bool spinForData();
+        void sampleRecvLatency();
+
+        // TimerManager bookkeeping: earliest queued deadline, entries still
+        // in the heap (the engine holds on to the socket until they drain)
+        TimePoint timer_at_ = TimePoint::max();
+        std::atomic<uint32_t> timer_refs_ = 0;
+        uint32_t timer_popped_ = 0;
+        bool timer_due_ = false;
+
+        // armed RTO or persist deadline, TimePoint::max() if none. TIME_WAIT
+        // is kept by the engine's TimeWaitTable once the socket is released.
+        TimePoint nextTimer() const;
+
+        // last ACK sent for an unacceptable segment without payload
+        TimePoint oow_ack_at_{};
+        static constexpr std::chrono::milliseconds OOW_ACK_INTERVAL{100};
 
         bool validSeqNum(uint32_t seq_start, size_t len) const;
-        bool validFlags(uint8_t flags) const;
+
+        // An unacceptable segment is answered with an ACK (RFC 793), so a
+        // retransmission whose ACK was lost or a window probe learns where
+        // we are. Pure ACKs get one answer per OOW_ACK_INTERVAL, which
+        // breaks ACK loops with a desynchronized peer.
+        bool ackRejected(const TCPHeader& tcphdr, size_t data_len);
+
+        // reader side, after draining: requests a window update if due
+        void checkWindow();
+        // engine side: a pure ACK carrying the current window
+        void sendWindowUpdate();
+
+        void setState(SocketState s);
+        void signal();
+        uint32_t awaitEvent(uint32_t seen);
+        void notifyReadable();
+        void notifyWritable();
+        void ringDoorbell();
+
+        bool startSplice(const std::shared_ptr<StreamSocket>& dst);
+        // received bytes and FIN on to splice_dst_
+        void forwardSpliced();
+        // splice_src_ side: len bytes it sent from our ring were acked
+        void releaseSpliced(size_t len);
+        void unsplice();
+
+        bool startConnect(const SocketAddr& addr);
+        // publishes the data to go with the SYN; the caller connects
+        ssize_t queueFastOpen(const std::byte* buf, size_t len);
+        bool startClose();
+        // RST to the peer, then CLOSED
+        bool startAbort();
+        void handleRequest(SocketRequest& req);
+        ssize_t sendRing(const std::byte* buf, size_t len);
+        ssize_t recvRing(std::byte* buf, size_t len);
 
         friend std::shared_ptr<StreamSocket> make_socket(TCPEngine&);
-        friend void TCPEngine::recv();
-        friend void TimerManager::timeoutLoop();
+        friend bool splice(const std::shared_ptr<StreamSocket>&, const std::shared_ptr<StreamSocket>&);
+        friend class TCPEngine;
+        friend class SendBuffer;
+        friend class TimerManager;
     public:
         StreamSocket(TCPEngine& engine);
-        SocketState _state = SocketState::CLOSED;
+        std::atomic<SocketState> _state = SocketState::CLOSED;
         // FIXME: delete this constructor and use factory method
         StreamSocket(const StreamSocket&) = delete;
         StreamSocket& operator=(const StreamSocket&) = delete;
@@ -56,11 +141,69 @@ class StreamSocket : public std::enable_shared_from_this<StreamSocket> {
 
         bool close();
 
+        // Drops the connection: the peer gets a RST, unsent and unread
+        // data are discarded.
+        bool abort();
+
         ssize_t send(const std::byte* buf, size_t len);
 
         ssize_t recv(std::byte* buf, size_t len);
 
+        // Non-blocking recv: 0 when nothing is readable, -1 once closed
+        ssize_t tryRecv(std::byte* buf, size_t len);
+
+        // Run-to-completion mode only, for callers that drive the engine
+        // from the same thread (simulation, replay): queue the request and
+        // return, progress shows up in _state.
+        bool connectAsync(const SocketAddr& addr);
+
+        bool listenAsync();
+
+        // TCP Fast Open (RFC 7413): connect() with len bytes of first
+        // request. With a cookie cached for the peer the data rides on the
+        // SYN and reaches the server a round trip early; otherwise the SYN
+        // asks for a cookie and the data follows the handshake. Returns the
+        // bytes queued (at most the send buffer), -1 if the connection
+        // failed.
+        ssize_t connectFastOpen(const SocketAddr& addr, const std::byte* buf, size_t len);
+
+        ssize_t connectFastOpenAsync(const SocketAddr& addr, const std::byte* buf, size_t len);
+
+        // Non-blocking send: bytes queued, 0 when the ring is full, -1 once closed
+        ssize_t trySend(const std::byte* buf, size_t len);
+
+        // Zero-copy send of len bytes of a regular file from offset, after
+        // whatever was sent before. Segments point into a mapping of the
+        // file, one window at a time, so nothing is copied into the send
+        // buffer and the call does not block. fd may be closed on return;
+        // the file must not shrink until the data is acked. Returns len, -1
+        // on error or once closed. A window that fails to map aborts the
+        // connection.
+        ssize_t sendFile(int fd, off_t offset, size_t len);
+
+        // Opt in to busy-polling receive; a zero budget turns it off.
+        void setBusyPoll(std::chrono::microseconds budget);
+
+        BusyPollStats getBusyPollStats() const;
+
+        // Cheap lock-free snapshot of the connection's protocol state
+        TCPInfo getInfo() const;
+
+        // Header prediction (Van Jacobson): an ESTABLISHED segment with
+        // only ACK/PSH set, starting at rcv_nxt with nothing queued out of
+        // order and acking within what was sent, skips validation and the
+        // state machine. Payload lands in the ring; the caller ACKs it.
+        // Returns false, having changed nothing, when the prediction fails.
+        bool fastPath(const TCPHeader& tcphdr, const std::byte* payload, const size_t data_len);
+
+        // Segment processing outside the fast path, driven by one lookup in
+        // the compile-time transition table (TCPStateTable.hpp)
         std::optional<uint8_t> handleCntrl(const TCPHeader& tcphdr, const SocketAddr& src_addr, const size_t data_len);
+
+        // Fast Open on a SYN or SYN-ACK just handled, which moved us out of
+        // from. Returns how much of its payload to take: a passive open
+        // takes SYN data only with a valid cookie, and otherwise offers one.
+        size_t handleSynOptions(SocketState from, const TCPOptions& opts, const size_t data_len);
 };
 
 }
\ No newline at end of file
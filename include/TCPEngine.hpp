@@ -3,9 +3,24 @@
 #include <memory>
 #include <unordered_map>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <mutex>
 
 #include <types.hpp>
 #include <TimerManager.hpp>
+#include <RequestQueue.hpp>
+#include <Metrics.hpp>
+#include <CaptureTap.hpp>
+#include <NetDevice.hpp>
+#include <LinkEmulator.hpp>
+#include <Clock.hpp>
+#include <SlabPool.hpp>
+#include <BufferPool.hpp>
+#include <TimeWaitTable.hpp>
+#include <SegmentCoalescer.hpp>
+#include <FastOpen.hpp>
 
 namespace ustacktcp {
 
@@ -14,34 +29,278 @@ struct EndpointHash {
         return std::hash<uint64_t>()(((uint64_t)e.ip.addr << 16) | e.port);
     }
 };
-    
+
 class RecvBuffer;
 class StreamSocket;
-    
+
+enum class EngineMode {
+    THREADED,           // recv thread + timer thread + application threads
+    RUN_TO_COMPLETION   // one loop thread owns all protocol state
+};
+
+struct EngineOptions {
+    EngineMode mode_ = EngineMode::THREADED;
+    size_t rx_batch_ = 32;   // max packets read per loop iteration
+    bool rx_coalesce_ = true;  // merge in-order segments of a batch (software GRO)
+    // Sockets queue, window and retransmit data in super-segments of up to
+    // 64KB, cut into MSS-sized packets by the device (TSO) or by send().
+    bool gso_ = true;
+    std::chrono::milliseconds idle_park_ = std::chrono::milliseconds(1);
+    std::chrono::microseconds busy_poll_ = std::chrono::microseconds(0); // RX spin before blocking
+    MetricsExportOptions metrics_export_;
+    std::shared_ptr<NetDevice> device_;  // RawSocketDevice when unset
+    std::optional<LinkEmulatorOptions> link_emulator_;  // impair traffic on device_
+    std::shared_ptr<Clock> clock_;       // protocol time; steady_clock when unset
+    size_t segment_pool_reserve_ = 256;  // segment descriptors preallocated
+    size_t buffer_cache_ = 64;           // drained socket buffers kept for reuse
+    std::chrono::milliseconds time_wait_ = std::chrono::seconds(60);
+    // connect() may take over a tuple that has been in TIME_WAIT this long
+    std::chrono::milliseconds time_wait_reuse_ = std::chrono::seconds(1);
+    uint8_t tos_ = 0;               // DSCP/ECN byte of every packet sent
+    bool dont_fragment_ = true;
+    // Attach a kernel filter built from the bound endpoints to devices that
+    // support one (RawSocketDevice), so other applications' traffic never
+    // reaches the engine. The port range below is then not consulted.
+    bool rx_filter_ = true;
+    // cheap port-range prefilter for devices without a filter
+    uint16_t port_lo_ = 40000;
+    uint16_t port_hi_ = 40010;
+    // Server side TCP Fast Open: hand out cookies and take data on SYNs
+    // that carry a valid one. Clients opt in per connection, see
+    // StreamSocket::connectFastOpen().
+    bool fast_open_ = false;
+    std::optional<FastOpenKey> fast_open_key_;  // random when unset
+};
+
+struct BusyPollStats {
+    uint64_t spin_hits_;  // data arrived while spinning
+    uint64_t sleeps_;     // spin budget ran out and we blocked
+};
+
+enum class RequestType {
+    BIND,
+    CONNECT,
+    LISTEN,
+    SEND,   // doorbell: new bytes were published to the send ring
+    WINDOW, // the reader freed enough room for a window update
+    CLOSE,
+    ABORT,
+    SPLICE  // sock_ relays what it receives to peer_
+};
+
+struct SocketRequest {
+    RequestType type_;
+    std::shared_ptr<StreamSocket> sock_;
+    SocketAddr addr_;
+    std::shared_ptr<StreamSocket> peer_ = nullptr;
+};
+
 class TCPEngine {
     private:
+    // declared first so they outlive every socket's buffers and segments
+    BufferPool buf_pool_;
+    SlabPool<TCPSegment> seg_pool_;
+
     // FIXME: create factory method for StreamSocket
+    // The only engine-side owner of a socket; reclaim() drops it once the
+    // socket is CLOSED and no timer entry points at it.
     std::unordered_map<SocketAddr, std::shared_ptr<StreamSocket>, EndpointHash> bound;
-    
-    std::vector<std::shared_ptr<StreamSocket>> sockets_;
-    
-    int _raw_fd;
-    
+    std::mutex bound_m_;  // threaded mode only; also guards tw_
+
+    // connections in TIME_WAIT, after their sockets were released
+    TimeWaitTable tw_;
+    // a new incarnation of a TIME_WAIT tuple starts this far past the old
+    // sequence space, out of reach of anything the old peer still sends
+    static constexpr uint32_t TIME_WAIT_ISS_GAP = 2 * 65536;
+
+    std::unique_lock<std::mutex> lockBound();
+
+    // Kernel RX filter, when the device took one; guarded like bound.
+    // A new endpoint the filter does not cover rebuilds it at once, while
+    // endpoints going away only mark it stale: it over-admits until the
+    // next rebuild, at most every RX_FILTER_REBUILD.
+    bool filter_ = false;
+    bool filter_stale_ = false;
+    RxFilter filter_set_;
+    TimePoint filter_built_;
+    static constexpr size_t RX_FILTER_ADDRS = 64;
+    static constexpr size_t RX_FILTER_PORTS = 512;
+    static constexpr std::chrono::milliseconds RX_FILTER_REBUILD{100};
+
+    // bound_m_ held
+    void refreshFilter();
+
+    // true when a TIME_WAIT entry answered or dropped the segment
+    bool timeWaitSegment(const TCPHeader& tcphdr, const SocketAddr& src_addr, const SocketAddr& dst_addr, size_t payload_len, StreamSocket* listener);
+
+    // moves a socket that reached TIME_WAIT into tw_, then reclaims it
+    void retire(StreamSocket& sock);
+
+    size_t expireTimers(TimePoint now);
+    void timerLoop();
+
+    std::shared_ptr<NetDevice> dev_;
+    std::shared_ptr<LinkEmulator> link_;
+
     friend std::shared_ptr<StreamSocket> make_socket(TCPEngine&);
 
+    EngineMetrics metrics_;
+
     TimerManager timer_;
 
+    EngineOptions opts_;
+
+    // after metrics_: its thread is joined before they are destroyed
+    std::unique_ptr<MetricsExporter> exporter_;
+
+    CaptureTap capture_;
+
+    std::atomic<uint16_t> ip_id_ = 0;  // only used without DF
+
+    FastOpen fast_open_;
+
+    // device TSO limit, see NetDevice::maxSegment()
+    size_t tso_max_ = 0;
+    // largest super-segment: whole MSS units in one 64KB IP packet
+    static constexpr size_t GSO_MAX = (65535 - PacketTemplate::SIZE) / TCP_MSS * TCP_MSS;
+
+    // one packet: the template, options if any, seg's payload (at most
+    // tso_max_ or one MSS)
+    ssize_t transmit(const TCPSegment& seg, const PacketTemplate& tmpl, uint32_t ack_num, uint16_t window, const TCPOptions* opts = nullptr);
+
+    // run-to-completion state
+    int wake_fd_ = -1;
+    std::atomic<bool> parked_ = false;
+    std::atomic<bool> running_ = false;
+    RequestQueue<SocketRequest> requests_;
+    std::vector<SocketRequest> pending_;
+
+    // RX busy-poll budget in ns: max of EngineOptions::busy_poll_ and every
+    // socket that opted in
+    std::atomic<int64_t> busy_poll_ns_ = 0;
+    StatCounter rx_spin_hits_;
+    StatCounter rx_sleeps_;
+
+    ssize_t recvSpin(std::byte* buffer, size_t len);
+
+    // RX thread (or the loop thread) only
+    SegmentCoalescer gro_;
+
+    // counts and captures one packet as read, then holds it for merging
+    void rxPacket(const std::byte* buffer, size_t data_size);
+    // processes the held packet; called at the end of every RX batch
+    void rxFlush();
+    void rxProcess(const std::byte* buffer, size_t data_size);
+
+    bool validTCPPort(uint16_t port) const;
+
+    size_t pollRX();
+    size_t drainRequests();
+    void park();
+
     public:
-    
-    TCPEngine();
-    
+
+    TCPEngine(const EngineOptions& opts = EngineOptions());
+
     bool bind(const SocketAddr& addr, std::shared_ptr<StreamSocket> socket);
-    
-    ssize_t send(std::shared_ptr<TCPSegment>& seg, const SocketAddr& src_addr, const SocketAddr& dest_addr, const RecvBuffer& recv_buf);
-    
+
+    // Drops the engine's references to sock if it is CLOSED; the memory
+    // goes once the application lets go as well.
+    void reclaim(StreamSocket& sock);
+
+    void armTimer(StreamSocket* sock, TimePoint at);
+
+    // sockets currently bound, closed ones awaiting reclaim included
+    size_t socketCount();
+
+    size_t timeWaitCount();
+
+    // Called before connecting sock to peer. Fails while the tuple is in
+    // TIME_WAIT and younger than EngineOptions::time_wait_reuse_; an older
+    // entry is taken over and sock's ISS placed past its sequence space.
+    bool claimTuple(StreamSocket& sock, const SocketAddr& peer);
+
+    // a connection's header template, with this engine's TOS and DF
+    void initTemplate(PacketTemplate& tmpl, const SocketAddr& src_addr, const SocketAddr& dest_addr) const;
+
+    // largest segment a socket should queue: GSO_MAX, or one MSS without gso_
+    size_t maxSegment() const;
+
+    // Segments longer than one MSS the device cannot take whole are split
+    // here; every packet is finished from the same template.
+    ssize_t send(TCPSegment& seg, const PacketTemplate& tmpl, RecvBuffer& recv_buf);
+
+    ssize_t send(TCPSegment& seg, const PacketTemplate& tmpl, uint32_t ack_num, uint16_t window);
+
+    // a SYN or SYN-ACK with options; seg's payload fits one packet
+    ssize_t send(TCPSegment& seg, const PacketTemplate& tmpl, RecvBuffer& recv_buf, const TCPOptions& opts);
+
+    // for segments outside any connection: builds the template on the spot
+    ssize_t send(TCPSegment& seg, const SocketAddr& src_addr, const SocketAddr& dest_addr, uint32_t ack_num, uint16_t window);
+
     void recv();
+
+    void processPacket(const std::byte* buffer, size_t data_size);
+
+    bool loopMode() const;
+
+    // true while run() is looping on some thread
+    bool running() const;
+
+    // protocol time: RTT samples, RTO and TIME_WAIT deadlines
+    TimePoint now() const;
+
+    // earliest pending timer or device deadline, TimePoint::max() if none
+    TimePoint nextDeadline() const;
+
+    // Run-to-completion mode: one iteration polls RX, expires timers and
+    // drains application requests, in that order. Returns the work done.
+    size_t poll();
+
+    void run();
+
+    void stop();
+
+    void post(SocketRequest&& req);
+
+    void requestBusyPoll(std::chrono::microseconds budget);
+
+    BusyPollStats getBusyPollStats() const;
+
+    EngineMetrics& metrics();
+
+    FastOpen& fastOpen();
+
+    // EngineOptions::fast_open_
+    bool fastOpenServer() const;
+
+    SlabPool<TCPSegment>& segmentPool();
+
+    BufferPool& bufferPool();
+
+    // pcapng capture of this engine's I/O; may be toggled at runtime
+    bool startCapture(const CaptureOptions& opts);
+
+    void stopCapture();
+
+    const CaptureTap& capture() const;
+
+    // nullptr unless EngineOptions::link_emulator_ was set
+    const LinkEmulator* linkEmulator() const;
 };
 
 std::shared_ptr<StreamSocket> make_socket(TCPEngine&);
 
+// In-engine relay for proxies, run-to-completion mode only: everything
+// src receives from now on, and whatever it holds unread, is sent on dst
+// by reference to src's receive ring, with no application thread involved.
+// Bytes leave src's ring only once dst's peer acks them, so the window src
+// advertises is the room dst's backlog leaves. src's FIN, or its abort,
+// closes dst. dst reaching CLOSED first aborts src, unless src's FIN and
+// everything before it got through. The application no longer reads src
+// nor writes dst; call again with the roles swapped for the other
+// direction. False if the sockets are on different engines, closed, or
+// already spliced.
+bool splice(const std::shared_ptr<StreamSocket>& src, const std::shared_ptr<StreamSocket>& dst);
+
 }
\ No newline at end of file
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <types.hpp>
+
+namespace ustacktcp {
+
+// Side effects of an accepted segment, applied by StreamSocket::handleCntrl
+// in this order
+enum TransitionAction : uint8_t {
+    ACT_ABORT    = 0x01,  // drop the connection: CLOSED, reply RST
+    ACT_ACK      = 0x02,  // synchronized: process ACK and window
+    ACT_PEER     = 0x04,  // latch the sender's address
+    ACT_IRS      = 0x08,  // latch the sender's ISN
+    ACT_ACK_SYN  = 0x10,  // the segment ACKs our SYN
+    ACT_ACK_DATA = 0x20   // reply ACK if the segment carries payload
+};
+
+// What a segment with given control bits does in given state. The next
+// state is next_drained_ instead of next_ once all our data, FIN
+// included, is acknowledged.
+struct Transition {
+    bool check_seq_;
+    uint8_t reply_;
+    uint8_t actions_;
+    SocketState next_;
+    SocketState next_drained_;
+};
+
+namespace state_table {
+
+constexpr size_t STATES = SocketState::CLOSING + 1;
+constexpr size_t FLAG_SETS = 16;
+
+constexpr uint8_t F = TCPFlag::FIN;
+constexpr uint8_t S = TCPFlag::SYN;
+constexpr uint8_t R = TCPFlag::RST;
+constexpr uint8_t A = TCPFlag::ACK;
+
+// SYN, FIN, RST and ACK folded into four bits; PSH and URG drop out
+constexpr size_t index(uint8_t flags)
+{
+    return (flags & (F | S | R)) | ((flags & A) >> 1);
+}
+
+constexpr uint8_t flagsAt(size_t i)
+{
+    return (i & (F | S | R)) | ((i & 0x08) << 1);
+}
+
+constexpr bool synchronized(SocketState s)
+{
+    return s != SocketState::CLOSED && s != SocketState::LISTEN
+        && s != SocketState::SYN_SENT && s != SocketState::SYN_RECEIVED;
+}
+
+// Control-bit combinations each state accepts; anything else aborts
+constexpr bool accepts(SocketState s, uint8_t f)
+{
+    const bool rst = f == R || f == (R | A);
+    switch (s)
+    {
+        case SocketState::LISTEN:
+            return f == S;
+        case SocketState::SYN_SENT:
+            // simultaneous open, normal handshake
+            return f == S || f == (S | A) || rst;
+        case SocketState::SYN_RECEIVED:
+            // handshake completion, or a FIN (rare but legal)
+            return f == A || f == F || rst;
+        case SocketState::FIN_WAIT_1:
+            // remote may close before ACKing our FIN
+            return f == A || f == (F | A) || f == F || rst;
+        case SocketState::ESTABLISHED:
+        case SocketState::FIN_WAIT_2:
+        case SocketState::TIME_WAIT:  // duplicate FINs
+            return f == A || f == (F | A) || rst;
+        case SocketState::CLOSE_WAIT:
+        case SocketState::CLOSING:
+        case SocketState::LAST_ACK:
+            return f == A || rst;
+        default:
+            return false;
+    }
+}
+
+constexpr Transition make(SocketState s, uint8_t f)
+{
+    // LISTEN and the handshake states have no receive window to check
+    // against yet, but only a segment they accept skips the check
+    const bool ok = accepts(s, f);
+    Transition t{!ok || synchronized(s), 0, 0, s, s};
+    if (!ok || (f & R))
+    {
+        t.reply_ = R;
+        t.actions_ = ACT_ABORT;
+        t.next_ = t.next_drained_ = SocketState::CLOSED;
+        return t;
+    }
+    if (synchronized(s)) t.actions_ |= ACT_ACK;
+
+    auto go = [&t](SocketState next) { t.next_ = t.next_drained_ = next; };
+    switch (s)
+    {
+        case SocketState::LISTEN:
+            t.reply_ = S | A;
+            t.actions_ |= ACT_PEER | ACT_IRS;
+            go(SocketState::SYN_RECEIVED);
+            break;
+        case SocketState::SYN_SENT:
+            t.actions_ |= ACT_IRS;
+            if (f == S)
+            {
+                t.reply_ = S | A;
+                go(SocketState::SYN_RECEIVED);
+            }
+            else
+            {
+                t.reply_ = A;
+                t.actions_ |= ACT_ACK_SYN;
+                go(SocketState::ESTABLISHED);
+            }
+            break;
+        case SocketState::SYN_RECEIVED:
+            if (f == A)
+            {
+                t.actions_ |= ACT_ACK_SYN;
+                go(SocketState::ESTABLISHED);
+            }
+            else
+            {
+                go(SocketState::LISTEN);
+            }
+            break;
+        case SocketState::ESTABLISHED:
+            if (f & F)
+            {
+                t.reply_ = A;
+                go(SocketState::CLOSE_WAIT);
+            }
+            else
+            {
+                t.actions_ |= ACT_ACK_DATA;
+            }
+            break;
+        case SocketState::FIN_WAIT_1:
+            // only an ACK that covers our FIN moves us on; until then the
+            // FIN keeps being retransmitted from here
+            if (f & F)
+            {
+                t.reply_ = A;
+                t.next_ = SocketState::CLOSING;
+                t.next_drained_ = SocketState::TIME_WAIT;
+            }
+            else
+            {
+                t.actions_ |= ACT_ACK_DATA;
+                t.next_drained_ = SocketState::FIN_WAIT_2;
+            }
+            break;
+        case SocketState::FIN_WAIT_2:
+            if (f & F)
+            {
+                t.reply_ = A;
+                go(SocketState::TIME_WAIT);
+            }
+            else
+            {
+                t.actions_ |= ACT_ACK_DATA;
+            }
+            break;
+        case SocketState::CLOSING:
+            t.next_drained_ = SocketState::TIME_WAIT;
+            break;
+        case SocketState::LAST_ACK:
+            t.next_drained_ = SocketState::CLOSED;
+            break;
+        default:
+            break;
+    }
+    return t;
+}
+
+using Table = std::array<std::array<Transition, FLAG_SETS>, STATES>;
+
+constexpr Table build()
+{
+    Table table{};
+    for (size_t s = 0; s < STATES; ++s)
+        for (size_t i = 0; i < FLAG_SETS; ++i)
+            table[s][i] = make(static_cast<SocketState>(s), flagsAt(i));
+    return table;
+}
+
+constexpr Table TABLE = build();
+
+constexpr bool all(bool (*pred)(SocketState, uint8_t, const Transition&))
+{
+    for (size_t s = 0; s < STATES; ++s)
+        for (size_t i = 0; i < FLAG_SETS; ++i)
+            if (!pred(static_cast<SocketState>(s), flagsAt(i), TABLE[s][i])) return false;
+    return true;
+}
+
+static_assert(index(0xFF) < FLAG_SETS);
+static_assert(index(S | TCPFlag::PSH) == index(S) && index(A | TCPFlag::URG) == index(A));
+
+// an abort is the only way to reply RST, and always lands in CLOSED
+static_assert(all([](SocketState, uint8_t, const Transition& t) {
+    return ((t.actions_ & ACT_ABORT) != 0) == ((t.reply_ & R) != 0)
+        && (!(t.actions_ & ACT_ABORT) || (t.actions_ == ACT_ABORT && t.next_ == SocketState::CLOSED
+                                          && t.next_drained_ == SocketState::CLOSED));
+}));
+
+// RST always aborts, a segment without control bits never gets through,
+// and nothing does in CLOSED
+static_assert(all([](SocketState s, uint8_t f, const Transition& t) {
+    return !((f & R) || f == 0 || s == SocketState::CLOSED) || (t.actions_ & ACT_ABORT);
+}));
+
+// sequence numbers are checked whenever a receive window exists
+static_assert(all([](SocketState s, uint8_t, const Transition& t) {
+    return !synchronized(s) || t.check_seq_;
+}));
+
+// ACKs are processed exactly in the synchronized states
+static_assert(all([](SocketState s, uint8_t, const Transition& t) {
+    return (t.actions_ & ACT_ABORT) || ((t.actions_ & ACT_ACK) != 0) == synchronized(s);
+}));
+
+// only the passive and simultaneous opens reply SYN; no reply carries FIN
+static_assert(all([](SocketState s, uint8_t, const Transition& t) {
+    return !(t.reply_ & F)
+        && (!(t.reply_ & S) || (s == SocketState::LISTEN || s == SocketState::SYN_SENT));
+}));
+
+// a FIN from the peer is ACKed unless the connection aborts, is still
+// half open (SYN_RECEIVED returns to LISTEN) or sits in TIME_WAIT, where
+// the engine's TimeWaitTable answers retransmitted FINs
+static_assert(all([](SocketState s, uint8_t f, const Transition& t) {
+    return !(f & F) || (t.actions_ & ACT_ABORT) || s == SocketState::SYN_RECEIVED
+        || s == SocketState::TIME_WAIT || t.reply_ == A;
+}));
+
+// states only depend on the drained flag where our FIN is outstanding
+static_assert(all([](SocketState s, uint8_t, const Transition& t) {
+    return t.next_ == t.next_drained_ || s == SocketState::FIN_WAIT_1 || s == SocketState::CLOSING
+        || s == SocketState::LAST_ACK;
+}));
+
+// TIME_WAIT is only left by an abort
+static_assert(all([](SocketState s, uint8_t, const Transition& t) {
+    return s != SocketState::TIME_WAIT || (t.actions_ & ACT_ABORT)
+        || (t.next_ == SocketState::TIME_WAIT && t.next_drained_ == SocketState::TIME_WAIT);
+}));
+
+}
+
+// One lookup per segment: legality, reply, actions and next state
+constexpr const Transition& transition(SocketState s, uint8_t flags)
+{
+    return state_table::TABLE[s][state_table::index(flags)];
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <types.hpp>
+#include <Clock.hpp>
+
+namespace ustacktcp {
+
+struct FourTuple {
+    SocketAddr local_;
+    SocketAddr peer_;
+
+    bool operator==(const FourTuple& o) const { return local_ == o.local_ && peer_ == o.peer_; }
+};
+
+struct FourTupleHash {
+    size_t operator()(const FourTuple& t) const noexcept {
+        uint64_t a = ((uint64_t)t.local_.ip.addr << 16) | t.local_.port;
+        uint64_t b = ((uint64_t)t.peer_.ip.addr << 16) | t.peer_.port;
+        return std::hash<uint64_t>()(a ^ (b * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+// What is left of a connection in TIME_WAIT: enough to re-ACK a
+// retransmitted FIN and to tell old duplicates from a new incarnation.
+struct TimeWaitEntry {
+    uint32_t snd_nxt_;   // our sequence number after the FIN
+    uint32_t rcv_nxt_;   // the peer's, after its FIN
+    TimePoint since_;    // entered TIME_WAIT
+    TimePoint expiry_;
+};
+
+// Connections in TIME_WAIT, keyed by 4-tuple. The full socket is released
+// as soon as its connection gets here. Entries expire after a fixed
+// timeout from a FIFO; a retransmitted FIN restarts it, and the stale FIFO
+// slot requeues the entry when it comes up. A requeued entry can land
+// behind later ones, so a restarted entry may linger slightly past its
+// deadline; TIME_WAIT only has to last at least that long.
+class TimeWaitTable {
+    private:
+        std::unordered_map<FourTuple, TimeWaitEntry, FourTupleHash> map_;
+        std::deque<std::pair<FourTuple, TimePoint>> fifo_;  // insertion order
+        std::chrono::steady_clock::duration timeout_;
+
+    public:
+        explicit TimeWaitTable(std::chrono::steady_clock::duration timeout);
+
+        void insert(const FourTuple& t, uint32_t snd_nxt, uint32_t rcv_nxt, TimePoint now);
+
+        // nullptr when the tuple is not in TIME_WAIT
+        TimeWaitEntry* find(const FourTuple& t);
+
+        void erase(const FourTuple& t);
+
+        // restarts the timeout, on a retransmitted FIN
+        void restart(TimeWaitEntry& e, TimePoint now);
+
+        // drops expired entries, returns how many
+        size_t expire(TimePoint now);
+
+        // TimePoint::max() when empty; may be early
+        TimePoint nextExpiry() const;
+
+        // appends the local endpoint of every entry
+        void locals(std::vector<SocketAddr>& out) const;
+
+        size_t size() const;
+
+        bool empty() const;
+};
+
+}
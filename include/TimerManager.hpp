@@ -2,21 +2,65 @@
 
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <functional>
+
+#include <Metrics.hpp>
+#include <Clock.hpp>
 
 namespace ustacktcp {
 
 class StreamSocket;
-    
+
+// Min-heap of socket RTO and persist deadlines. Only sockets with data in
+// flight or waiting on a closed window are queued, so idle connections
+// cost nothing here. Deadlines that move later (every ACK restarts the
+// RTO) do not touch the heap: the stale entry fires, finds nothing due
+// and requeues the socket at its current deadline. A socket keeps one entry for its earliest deadline and counts
+// its queued entries, so the engine never reclaims a socket the heap still
+// points at.
+//
+// In threaded mode setShared(true) puts a mutex around the heap.
 class TimerManager {
     private:
 
-    std::vector<std::shared_ptr<StreamSocket>> sock_;
+    struct Entry {
+        TimePoint at_;
+        StreamSocket* sock_;
+
+        bool operator>(const Entry& o) const { return at_ > o.at_; }
+    };
+
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> q_;
+    std::vector<std::shared_ptr<StreamSocket>> due_;
+
+    mutable std::mutex m_;
+    bool shared_ = false;
+
+    MetricCounter& fires_;
+
+    void lock() const;
+    void unlock() const;
 
     public:
 
-    void insertSocket(const std::shared_ptr<StreamSocket>&);
+    TimerManager(MetricCounter& fires);
+
+    void setShared(bool shared);
+
+    // queue sock for at unless it already has an entry at or before it
+    void schedule(StreamSocket* sock, TimePoint at);
+
+    // Fires every timer due at now; returns the number fired.
+    size_t expire(const TimePoint now);
+
+    // earliest queued deadline, TimePoint::max() if none; may be early
+    TimePoint nextExpiry() const;
 
-    void timeoutLoop();
+    // queued entries, stale ones included
+    size_t size() const;
 };
 
-}
\ No newline at end of file
+}
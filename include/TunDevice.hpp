@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include <types.hpp>
+#include <NetDevice.hpp>
+
+namespace ustacktcp {
+
+struct TunOptions {
+    std::string name_ = "ustack0";
+    size_t queues_ = 1;           // one per engine; the kernel spreads flows by hash
+    bool vnet_hdr_ = true;        // GSO/GRO metadata with every packet
+    // The host's end of the link, in host order. The engine takes another
+    // address in the subnet, which the host routes into the TUN but does
+    // not own, so its own TCP stack never answers for it. 0 leaves the
+    // interface unconfigured.
+    uint32_t host_addr_ = 0;
+    uint8_t prefix_len_ = 24;
+    size_t mtu_ = 1500;
+};
+
+// One queue of a TUN interface (IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE).
+// Packets are plain IPv4.
+//
+// With vnet_hdr_ every packet carries a virtio_net_hdr. transmit() hands a
+// segment longer than the MSS to the kernel as one TSO super-segment,
+// which it splits and checksums. The kernel may deliver coalesced (GRO)
+// packets of up to 64KB the same way; those, and the partially
+// checksummed ones from the host's own stack, were checked or built by
+// the kernel and need no verification here.
+class TunDevice : public NetDevice {
+    private:
+        int fd_;
+        bool vnet_;
+        size_t mss_;
+        StatCounter rx_coalesced_;
+        StatCounter tx_super_;
+
+        TunDevice(int fd, bool vnet, size_t mss);
+
+    public:
+        // Creates or attaches the interface and opens one device per queue;
+        // empty on failure
+        static std::vector<std::shared_ptr<TunDevice>> open(const TunOptions& opts);
+
+        ~TunDevice();
+
+        TunDevice(const TunDevice&) = delete;
+        TunDevice& operator=(const TunDevice&) = delete;
+
+        ssize_t transmit(const std::byte* pkt, size_t len) override;
+
+        ssize_t receive(std::byte* buf, size_t len, bool nonblock) override;
+
+        int pollFd() const override;
+
+        // nothing to narrow: only traffic routed to the engine's address
+        // comes through the interface
+        bool setFilter(const RxFilter& filter) override;
+
+        // 64KB with vnet_hdr_, otherwise the MSS
+        size_t maxSegment() const override;
+
+        // GRO packets received and TSO super-segments sent
+        uint64_t rxCoalesced() const;
+        uint64_t txSuperSegments() const;
+};
+
+}
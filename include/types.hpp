@@ -6,6 +6,7 @@
 #include <cstddef>
 #include <chrono>
 #include <memory>
+#include <atomic>
 
 namespace ustacktcp {
 
@@ -14,6 +15,15 @@ namespace ustacktcp {
 #define SEQ_GT(a,b)   ((int32_t)((a) - (b)) > 0)
 #define SEQ_GEQ(a,b)  ((int32_t)((a) - (b)) >= 0)
 
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 
 enum SocketState {
     CLOSED,
@@ -70,8 +80,23 @@ struct SocketAddr {
 };
 
 
+// TCP options the stack reads and writes; so far only Fast Open (RFC
+// 7413). Unknown options are skipped on receive.
 struct TCPOptions {
-    // TODO: To be implemented
+    static constexpr uint8_t KIND_FAST_OPEN = 34;
+    static constexpr size_t COOKIE_MAX = 16;
+
+    bool fast_open_ = false;  // option present; without a cookie it requests one
+    uint8_t cookie_len_ = 0;
+    uint8_t cookie_[COOKIE_MAX] = {};
+
+    TCPOptions() = default;
+
+    // the option bytes between the fixed TCP header and the payload
+    TCPOptions(const std::byte* buf, size_t len);
+
+    // NOP-padded to a multiple of 4; returns the bytes written, at most 40
+    size_t write(std::byte* buf) const;
 };
 
 struct PseudoIPv4Header {
@@ -95,12 +120,38 @@ struct InternetChecksumBuilder {
     public:
     InternetChecksumBuilder();
 
+        // resumes from a partial() taken earlier
+        explicit InternetChecksumBuilder(uint32_t partial);
+
         void add(const void* buf, size_t len);
 
+        // one 16-bit word in host order
+        void addWord(uint16_t word);
+
+        // running sum, not yet complemented
+        uint32_t partial() const;
+
         uint16_t finalize();
 };
 
 
+// Prebuilt IPv4 + TCP header of one connection. Transmitting copies it,
+// patches the per-segment fields and finishes both checksums from sums
+// taken over the fixed ones.
+struct PacketTemplate {
+    static constexpr size_t IP_SIZE = 20;
+    static constexpr size_t SIZE = IP_SIZE + 20;
+
+    std::byte hdr_[SIZE] = {};
+    uint32_t ip_sum_ = 0;   // IP header without total length and id
+    uint32_t tcp_sum_ = 0;  // pseudo-header without length, plus ports
+
+    void build(const SocketAddr& src, const SocketAddr& dst, uint8_t tos, bool dont_fragment);
+
+    // pkt starts with a copy of hdr_ followed by the payload, len bytes in all
+    void finish(std::byte* pkt, size_t len, uint16_t ip_id, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window) const;
+};
+
 // TODO: include options
 struct IPHeader {
     uint8_t version_ihl; // Version (4 bits) + Internet header length (4 bits)
@@ -125,6 +176,16 @@ struct IPHeader {
     uint8_t getVersion() const;
 };
 
+// payload of one packet on the wire
+static constexpr size_t TCP_MSS = 1460;
+
+// Where a segment's payload lives, i.e. what to release once it is acked
+enum class PayloadSource : uint8_t {
+    RING,    // the socket's send ring
+    FILE,    // a sendFile() mapping
+    SPLICE   // the receive ring of the socket spliced into this one
+};
+
 struct TCPSegment {
     const std::byte* data_;
     const std::byte* data2_;
@@ -133,7 +194,9 @@ struct TCPSegment {
     uint32_t brk_len_;
     size_t retransmit_cnt_;
     uint8_t flags_;
-    std::chrono::steady_clock::time_point send_tmstp_;
+    PayloadSource source_ = PayloadSource::RING;
+    std::chrono::steady_clock::time_point send_tmstp_;  // set by TCPEngine::send
+    TCPSegment* next_ = nullptr;                        // SegmentList link
 
     TCPSegment(const std::byte* data, const std::byte* data2, uint32_t seq_start, uint32_t len, uint32_t brk_len, uint8_t flags)
     :   data_(data),
@@ -142,23 +205,100 @@ struct TCPSegment {
         len_(len),
         brk_len_(brk_len),
         retransmit_cnt_(0),
-        flags_(flags),
-        send_tmstp_(std::chrono::steady_clock::now())
+        flags_(flags)
     {}
-};
 
-struct TCPSegmentHeapCompare {
-    bool operator()(const std::shared_ptr<TCPSegment>& a, const std::shared_ptr<TCPSegment>& b) const
+    // drops the first n payload bytes, n < len_
+    void advance(uint32_t n)
     {
-        return a->seq_start_ > b->seq_start_;
+        if (n < brk_len_)
+        {
+            data_ += n;
+            brk_len_ -= n;
+        }
+        else
+        {
+            data_ = data2_ + (n - brk_len_);
+            brk_len_ = len_ - n;
+        }
+        seq_start_ += n;
+        len_ -= n;
     }
 };
 
-struct TCPSegmentMapCompare {
-    bool operator()(uint32_t a, uint32_t b) const {
-        // true if a is "less than" b in TCP seq space
-        return SEQ_LT(a, b);
+// Intrusive FIFO of segments. Segments are created and sent in sequence
+// order, so a FIFO keeps both the send queue and the retransmit queue
+// sorted without a heap.
+struct SegmentList {
+    TCPSegment* head_ = nullptr;
+    TCPSegment* tail_ = nullptr;
+
+    bool empty() const { return head_ == nullptr; }
+
+    TCPSegment* front() const { return head_; }
+
+    void push_back(TCPSegment* s)
+    {
+        s->next_ = nullptr;
+        if (tail_) tail_->next_ = s;
+        else head_ = s;
+        tail_ = s;
+    }
+
+    void push_front(TCPSegment* s)
+    {
+        s->next_ = head_;
+        head_ = s;
+        if (!tail_) tail_ = s;
+    }
+
+    void insert_after(TCPSegment* at, TCPSegment* s)
+    {
+        s->next_ = at->next_;
+        at->next_ = s;
+        if (tail_ == at) tail_ = s;
     }
+
+    TCPSegment* pop_front()
+    {
+        TCPSegment* s = head_;
+        head_ = s->next_;
+        if (!head_) tail_ = nullptr;
+        s->next_ = nullptr;
+        return s;
+    }
+};
+
+// Statistic with a single writer: a relaxed load/store pair instead of a
+// locked read-modify-write, so the hot path never contends and readers on
+// other threads get a stale but untorn value.
+struct StatCounter {
+    std::atomic<uint64_t> v_ = 0;
+
+    void add(uint64_t n = 1) { v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    void set(uint64_t n) { v_.store(n, std::memory_order_relaxed); }
+    uint64_t get() const { return v_.load(std::memory_order_relaxed); }
+};
+
+// Per-connection snapshot, modelled on Linux struct tcp_info
+struct TCPInfo {
+    SocketState state_;
+    uint32_t rtt_us_;
+    uint32_t rttvar_us_;
+    uint32_t rto_us_;
+    uint64_t cwnd_;             // bytes
+    uint64_t ssthresh_;         // bytes
+    uint64_t bytes_in_flight_;
+    uint64_t bytes_sent_;       // payload bytes put on the wire, incl. retransmits
+    uint64_t bytes_retrans_;
+    uint64_t bytes_acked_;
+    uint64_t bytes_received_;   // in-order payload bytes
+    uint64_t total_retrans_;    // retransmitted segments
+    uint64_t dup_acks_;
+    uint32_t rcv_wnd_;          // window we advertise
+    uint32_t snd_wnd_;          // window the peer advertises
+    uint64_t rwnd_limited_us_;  // time with data queued but blocked by snd_wnd
+    uint64_t cwnd_limited_us_;  // time with data queued but blocked by cwnd
 };
 
 enum TCPFlag : uint8_t {
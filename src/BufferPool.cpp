@@ -0,0 +1,74 @@
+#include <BufferPool.hpp>
+#include <types.hpp>
+
+namespace ustacktcp {
+
+BufferPool::BufferPool(size_t block_size, size_t max_cached) : block_size_(block_size), max_cached_(max_cached) {}
+
+BufferPool::~BufferPool()
+{
+    while (free_)
+    {
+        Block* b = free_;
+        free_ = b->next_;
+        delete[] reinterpret_cast<std::byte*>(b);
+    }
+}
+
+void BufferPool::lock()
+{
+    while (lock_.test_and_set(std::memory_order_acquire)) cpuRelax();
+}
+
+void BufferPool::unlock()
+{
+    lock_.clear(std::memory_order_release);
+}
+
+std::byte* BufferPool::acquire()
+{
+    live_.fetch_add(1, std::memory_order_relaxed);
+    lock();
+    Block* b = free_;
+    if (b)
+    {
+        free_ = b->next_;
+        cached_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    unlock();
+    if (b) return reinterpret_cast<std::byte*>(b);
+    return new std::byte[block_size_];
+}
+
+void BufferPool::release(std::byte* block)
+{
+    live_.fetch_sub(1, std::memory_order_relaxed);
+    lock();
+    if (cached_.load(std::memory_order_relaxed) < max_cached_)
+    {
+        Block* b = reinterpret_cast<Block*>(block);
+        b->next_ = free_;
+        free_ = b;
+        cached_.fetch_add(1, std::memory_order_relaxed);
+        block = nullptr;
+    }
+    unlock();
+    delete[] block;
+}
+
+size_t BufferPool::blockSize() const
+{
+    return block_size_;
+}
+
+size_t BufferPool::live() const
+{
+    return live_.load(std::memory_order_relaxed);
+}
+
+size_t BufferPool::cached() const
+{
+    return cached_.load(std::memory_order_relaxed);
+}
+
+}
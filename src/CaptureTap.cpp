@@ -0,0 +1,229 @@
+#include <CaptureTap.hpp>
+
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <arpa/inet.h>
+
+namespace ustacktcp {
+
+namespace {
+
+constexpr uint16_t LINKTYPE_RAW = 101;  // raw IPv4/IPv6, no link header
+constexpr uint32_t EPB_FLAG_INBOUND = 1;
+constexpr uint32_t EPB_FLAG_OUTBOUND = 2;
+
+void put32(FILE* f, uint32_t v) { fwrite(&v, sizeof(v), 1, f); }
+void put16(FILE* f, uint16_t v) { fwrite(&v, sizeof(v), 1, f); }
+
+}
+
+bool CaptureFilter::matches(uint32_t src_ip, uint16_t src_port, uint32_t dst_ip, uint16_t dst_port) const
+{
+    auto fwd = [this](uint32_t sip, uint16_t sp, uint32_t dip, uint16_t dp) {
+        return (src_ip_ == 0 || src_ip_ == sip) && (src_port_ == 0 || src_port_ == sp) &&
+               (dst_ip_ == 0 || dst_ip_ == dip) && (dst_port_ == 0 || dst_port_ == dp);
+    };
+    return fwd(src_ip, src_port, dst_ip, dst_port) || (bidirectional_ && fwd(dst_ip, dst_port, src_ip, src_port));
+}
+
+CaptureTap::~CaptureTap()
+{
+    stop();
+}
+
+void CaptureTap::writeHeader()
+{
+    // Section Header Block
+    put32(out_, 0x0A0D0D0A);
+    put32(out_, 28);
+    put32(out_, 0x1A2B3C4D);
+    put16(out_, 1);
+    put16(out_, 0);
+    int64_t section_len = -1;
+    fwrite(&section_len, sizeof(section_len), 1, out_);
+    put32(out_, 28);
+
+    // Interface Description Block with nanosecond timestamps
+    put32(out_, 1);
+    put32(out_, 32);
+    put16(out_, LINKTYPE_RAW);
+    put16(out_, 0);
+    put32(out_, opts_.snaplen_);
+    put16(out_, 9);  // if_tsresol
+    put16(out_, 1);
+    uint8_t tsresol[4] = {9, 0, 0, 0};
+    fwrite(tsresol, 1, sizeof(tsresol), out_);
+    put32(out_, 0);  // opt_endofopt
+    put32(out_, 32);
+}
+
+bool CaptureTap::start(const CaptureOptions& opts)
+{
+    if (enabled_.load()) return false;
+    if (opts.ring_slots_ == 0 || (opts.ring_slots_ & (opts.ring_slots_ - 1))) return false;
+
+    out_ = fopen(opts.path_.c_str(), "wb");
+    if (!out_)
+    {
+        perror("CaptureTap::fopen");
+        return false;
+    }
+    opts_ = opts;
+    if (opts_.sample_every_ == 0) opts_.sample_every_ = 1;
+    slot_bytes_ = sizeof(RecordHeader) + opts_.snaplen_;
+    mask_ = opts_.ring_slots_ - 1;
+    slots_ = std::make_unique<Slot[]>(opts_.ring_slots_);
+    for (size_t i = 0; i < opts_.ring_slots_; ++i) slots_[i].seq_.store(i, std::memory_order_relaxed);
+    data_ = std::make_unique<std::byte[]>(slot_bytes_ * opts_.ring_slots_);
+    tail_.store(0);
+    head_ = 0;
+    sample_ctr_.store(0);
+    captured_.store(0);
+    dropped_.store(0);
+    writeHeader();
+
+    stopping_.store(false);
+    writer_ = std::thread(&CaptureTap::writerLoop, this);
+    enabled_.store(true);
+    return true;
+}
+
+void CaptureTap::stop()
+{
+    if (!enabled_.exchange(false)) return;
+    while (users_.load() != 0) std::this_thread::yield();
+    stopping_.store(true);
+    writer_.join();
+    fclose(out_);
+    out_ = nullptr;
+    slots_.reset();
+    data_.reset();
+}
+
+bool CaptureTap::enabled() const
+{
+    return enabled_.load(std::memory_order_relaxed);
+}
+
+uint64_t CaptureTap::captured() const
+{
+    return captured_.load(std::memory_order_relaxed);
+}
+
+uint64_t CaptureTap::dropped() const
+{
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+bool CaptureTap::push(const std::byte* ip_hdr, size_t ip_hdr_len, const std::byte* payload, size_t payload_len, bool outbound)
+{
+    // bounded MPSC queue: claim a slot by CAS on tail_, publish via its seq_
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true)
+    {
+        slot = &slots_[pos & mask_];
+        size_t seq = slot->seq_.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else if (diff < 0)
+        {
+            return false; // full
+        }
+        else
+        {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::byte* rec = data_.get() + (pos & mask_) * slot_bytes_;
+    RecordHeader hdr;
+    hdr.ts_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    hdr.orig_len_ = ip_hdr_len + payload_len;
+    hdr.cap_len_ = std::min<size_t>(hdr.orig_len_, opts_.snaplen_);
+    hdr.outbound_ = outbound;
+    memcpy(rec, &hdr, sizeof(hdr));
+    std::byte* dst = rec + sizeof(hdr);
+    size_t first = std::min<size_t>(ip_hdr_len, hdr.cap_len_);
+    memcpy(dst, ip_hdr, first);
+    if (first < hdr.cap_len_) memcpy(dst + first, payload, hdr.cap_len_ - first);
+
+    slot->seq_.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool CaptureTap::drainOne()
+{
+    Slot& slot = slots_[head_ & mask_];
+    if (slot.seq_.load(std::memory_order_acquire) != head_ + 1) return false;
+
+    const std::byte* rec = data_.get() + (head_ & mask_) * slot_bytes_;
+    RecordHeader hdr;
+    memcpy(&hdr, rec, sizeof(hdr));
+
+    // Enhanced Packet Block
+    uint32_t pad = (4 - hdr.cap_len_ % 4) % 4;
+    uint32_t total = 32 + hdr.cap_len_ + pad + 12;
+    put32(out_, 6);
+    put32(out_, total);
+    put32(out_, 0);
+    put32(out_, hdr.ts_ns_ >> 32);
+    put32(out_, hdr.ts_ns_ & 0xFFFFFFFF);
+    put32(out_, hdr.cap_len_);
+    put32(out_, hdr.orig_len_);
+    fwrite(rec + sizeof(hdr), 1, hdr.cap_len_, out_);
+    uint8_t zeros[4] = {};
+    fwrite(zeros, 1, pad, out_);
+    put16(out_, 2);  // epb_flags
+    put16(out_, 4);
+    put32(out_, hdr.outbound_ ? EPB_FLAG_OUTBOUND : EPB_FLAG_INBOUND);
+    put32(out_, 0);  // opt_endofopt
+    put32(out_, total);
+
+    slot.seq_.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+}
+
+void CaptureTap::writerLoop()
+{
+    while (true)
+    {
+        bool wrote = false;
+        while (drainOne()) wrote = true;
+        if (stopping_.load() && tail_.load() == head_) break;
+        if (wrote) fflush(out_);
+        else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    fflush(out_);
+}
+
+void CaptureTap::tapIPv4(const std::byte* pkt, size_t len, bool outbound)
+{
+    if (!enabled_.load(std::memory_order_relaxed)) return;
+    users_.fetch_add(1);
+    if (enabled_.load() && len >= 20)
+    {
+        size_t ihl = (std::to_integer<uint8_t>(pkt[0]) & 0x0F) * 4;
+        if (len >= ihl + 4)
+        {
+            uint32_t src_ip = ntohl(*reinterpret_cast<const uint32_t*>(pkt + 12));
+            uint32_t dst_ip = ntohl(*reinterpret_cast<const uint32_t*>(pkt + 16));
+            uint16_t src_port = ntohs(*reinterpret_cast<const uint16_t*>(pkt + ihl));
+            uint16_t dst_port = ntohs(*reinterpret_cast<const uint16_t*>(pkt + ihl + 2));
+            if (opts_.filter_.matches(src_ip, src_port, dst_ip, dst_port) &&
+                sample_ctr_.fetch_add(1, std::memory_order_relaxed) % opts_.sample_every_ == 0)
+            {
+                if (push(pkt, len, nullptr, 0, outbound)) captured_.fetch_add(1, std::memory_order_relaxed);
+                else dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    users_.fetch_sub(1);
+}
+
+}
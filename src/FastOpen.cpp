@@ -0,0 +1,109 @@
+#include <FastOpen.hpp>
+
+#include <cstring>
+#include <random>
+
+namespace ustacktcp {
+
+namespace {
+
+uint64_t rotl(uint64_t x, int b)
+{
+    return (x << b) | (x >> (64 - b));
+}
+
+void sipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+{
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+}
+
+// SipHash-2-4 of one 8-byte block
+uint64_t sipHash(uint64_t k0, uint64_t k1, uint64_t m)
+{
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    auto compress = [&](uint64_t b) {
+        v3 ^= b;
+        sipRound(v0, v1, v2, v3);
+        sipRound(v0, v1, v2, v3);
+        v0 ^= b;
+    };
+    compress(m);
+    compress(8ULL << 56);  // message length in the final block
+    v2 ^= 0xFF;
+    for (int i = 0; i < 4; ++i) sipRound(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+}
+
+FastOpen::FastOpen(const std::optional<FastOpenKey>& key)
+{
+    FastOpenKey k;
+    if (key)
+    {
+        k = *key;
+    }
+    else
+    {
+        std::random_device rd;
+        for (size_t i = 0; i < k.size(); i += 4)
+        {
+            uint32_t r = rd();
+            memcpy(k.data() + i, &r, sizeof(r));
+        }
+    }
+    memcpy(&k0_, k.data(), sizeof(k0_));
+    memcpy(&k1_, k.data() + 8, sizeof(k1_));
+}
+
+uint64_t FastOpen::mac(uint32_t client, uint32_t server) const
+{
+    return sipHash(k0_, k1_, ((uint64_t)client << 32) | server);
+}
+
+void FastOpen::cookie(TCPOptions& opts, uint32_t client, uint32_t server) const
+{
+    uint64_t m = mac(client, server);
+    opts.fast_open_ = true;
+    opts.cookie_len_ = COOKIE_LEN;
+    memcpy(opts.cookie_, &m, COOKIE_LEN);
+}
+
+bool FastOpen::valid(const TCPOptions& opts, uint32_t client, uint32_t server) const
+{
+    if (opts.cookie_len_ != COOKIE_LEN) return false;
+    uint64_t m = mac(client, server);
+    return memcmp(opts.cookie_, &m, COOKIE_LEN) == 0;
+}
+
+bool FastOpen::lookup(uint32_t server, TCPOptions& opts)
+{
+    std::lock_guard lock(m_);
+    auto it = cache_.find(server);
+    if (it == cache_.end()) return false;
+    opts.cookie_len_ = it->second.cookie_len_;
+    memcpy(opts.cookie_, it->second.cookie_, opts.cookie_len_);
+    return true;
+}
+
+void FastOpen::store(uint32_t server, const TCPOptions& opts)
+{
+    std::lock_guard lock(m_);
+    // no eviction order worth keeping: start over when full
+    if (cache_.size() >= CACHE_MAX && !cache_.count(server)) cache_.clear();
+    cache_[server] = opts;
+}
+
+void FastOpen::forget(uint32_t server)
+{
+    std::lock_guard lock(m_);
+    cache_.erase(server);
+}
+
+}
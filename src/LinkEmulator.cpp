@@ -0,0 +1,217 @@
+#include <LinkEmulator.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <poll.h>
+#include <arpa/inet.h>
+
+namespace ustacktcp {
+
+double LinkEmulator::Direction::uniform()
+{
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
+}
+
+bool LinkEmulator::Direction::lose()
+{
+    if (prof_.burst_.p_ > 0)
+    {
+        if (bad_) bad_ = uniform() >= prof_.burst_.r_;
+        else bad_ = uniform() < prof_.burst_.p_;
+        if (uniform() < (bad_ ? prof_.burst_.loss_bad_ : prof_.burst_.loss_good_)) return true;
+    }
+    return prof_.loss_ > 0 && uniform() < prof_.loss_;
+}
+
+LinkEmulator::LinkEmulator(std::shared_ptr<NetDevice> inner, const LinkEmulatorOptions& opts, std::shared_ptr<Clock> clock)
+:   inner_(std::move(inner)),
+    clock_(std::move(clock))
+{
+    tx_.prof_ = opts.tx_;
+    rx_.prof_ = opts.rx_;
+    // independent streams so one direction's traffic doesn't shift the other's draws
+    tx_.rng_.seed(opts.seed_);
+    rx_.rng_.seed(opts.seed_ ^ 0x9E3779B97F4A7C15ull);
+}
+
+void LinkEmulator::admit(Direction& dir, const std::byte* pkt, size_t len, TimePoint now)
+{
+    const LinkProfile& prof = dir.prof_;
+    if (dir.lose())
+    {
+        dir.stats_.lost_.add();
+        return;
+    }
+
+    TimePoint departure = now;
+    if (prof.rate_bps_ > 0)
+    {
+        TimePoint start = std::max(now, dir.link_free_);
+        if (prof.queue_bytes_ > 0)
+        {
+            auto backlog_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - now).count();
+            uint64_t backlog = (uint64_t)backlog_ns * prof.rate_bps_ / 8000000000ull;
+            if (backlog + len > prof.queue_bytes_)
+            {
+                dir.stats_.queue_drops_.add();
+                return;
+            }
+        }
+        dir.link_free_ = start + std::chrono::nanoseconds(len * 8000000000ull / prof.rate_bps_);
+        departure = dir.link_free_;
+    }
+
+    Held h{departure, order_++, std::vector<std::byte>(pkt, pkt + len)};
+    if (prof.reorder_ > 0 && dir.uniform() < prof.reorder_)
+    {
+        dir.stats_.reordered_.add();
+    }
+    else
+    {
+        auto d = std::chrono::duration_cast<std::chrono::nanoseconds>(prof.delay_);
+        if (prof.jitter_.count() > 0)
+        {
+            auto j = std::chrono::duration_cast<std::chrono::nanoseconds>(prof.jitter_).count();
+            d += std::chrono::nanoseconds((int64_t)((dir.uniform() * 2 - 1) * j));
+            if (d.count() < 0) d = std::chrono::nanoseconds(0);
+        }
+        h.due_ = std::max(departure + d, dir.last_due_);
+        dir.last_due_ = h.due_;
+    }
+
+    if (prof.ce_mark_ > 0 && dir.uniform() < prof.ce_mark_ && markCE(h.bytes_)) dir.stats_.ce_marked_.add();
+
+    if (prof.duplicate_ > 0 && dir.uniform() < prof.duplicate_)
+    {
+        dir.stats_.duplicated_.add();
+        Held copy{h.due_, order_++, h.bytes_};
+        dir.q_.push(std::move(copy));
+    }
+    dir.stats_.passed_.add();
+    dir.q_.push(std::move(h));
+}
+
+bool LinkEmulator::markCE(std::vector<std::byte>& pkt)
+{
+    if (pkt.size() < 20) return false;
+    uint8_t tos = std::to_integer<uint8_t>(pkt[1]);
+    if ((tos & 0x03) == 0 || (tos & 0x03) == 0x03) return false; // Not-ECT, or already CE
+    pkt[1] = std::byte(tos | 0x03);
+    size_t ihl = (std::to_integer<uint8_t>(pkt[0]) & 0x0F) * 4;
+    pkt[10] = pkt[11] = std::byte{0};
+    InternetChecksumBuilder chksum;
+    chksum.add(pkt.data(), ihl);
+    uint16_t sum = htons(chksum.finalize());
+    memcpy(pkt.data() + 10, &sum, sizeof(sum));
+    return true;
+}
+
+void LinkEmulator::flushTX(TimePoint now)
+{
+    while (!tx_.q_.empty() && tx_.q_.top().due_ <= now)
+    {
+        const Held& h = tx_.q_.top();
+        inner_->transmit(h.bytes_.data(), h.bytes_.size());
+        tx_.q_.pop();
+    }
+}
+
+TimePoint LinkEmulator::clockNow() const
+{
+    return clock_ ? clock_->now() : std::chrono::steady_clock::now();
+}
+
+TimePoint LinkEmulator::nextDue() const
+{
+    auto t = TimePoint::max();
+    if (!tx_.q_.empty()) t = tx_.q_.top().due_;
+    if (!rx_.q_.empty()) t = std::min(t, rx_.q_.top().due_);
+    return t;
+}
+
+ssize_t LinkEmulator::transmit(const std::byte* pkt, size_t len)
+{
+    std::lock_guard lock(m_);
+    const auto now = clockNow();
+    admit(tx_, pkt, len, now);
+    flushTX(now);
+    return len; // a lossy wire still accepted the packet
+}
+
+ssize_t LinkEmulator::receive(std::byte* buf, size_t len, bool nonblock)
+{
+    std::byte pkt[65536];
+    while (true)
+    {
+        TimePoint wake;
+        {
+            std::lock_guard lock(m_);
+            auto now = clockNow();
+            flushTX(now);
+            ssize_t n;
+            while ((n = inner_->receive(pkt, sizeof(pkt), true)) >= 0) admit(rx_, pkt, n, now);
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            if (!rx_.q_.empty() && rx_.q_.top().due_ <= now)
+            {
+                const Held& h = rx_.q_.top();
+                size_t sz = std::min(len, h.bytes_.size());
+                memcpy(buf, h.bytes_.data(), sz);
+                rx_.q_.pop();
+                return sz;
+            }
+            if (nonblock)
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+            // wake at least every millisecond to release delayed transmits
+            wake = std::min(nextDue(), now + std::chrono::milliseconds(1));
+        }
+        int fd = inner_->pollFd();
+        if (fd >= 0)
+        {
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(wake - clockNow()).count();
+            pollfd pfd{fd, POLLIN, 0};
+            ::poll(&pfd, 1, std::max<int>(0, ms));
+        }
+        else
+        {
+            std::this_thread::sleep_for(wake - clockNow());
+        }
+    }
+}
+
+int LinkEmulator::pollFd() const
+{
+    // held packets don't make this readable; pollers must time out to release them
+    return inner_->pollFd();
+}
+
+void LinkEmulator::setBusyPoll(std::chrono::microseconds budget)
+{
+    inner_->setBusyPoll(budget);
+}
+
+bool LinkEmulator::setFilter(const RxFilter& filter)
+{
+    return inner_->setFilter(filter);
+}
+
+TimePoint LinkEmulator::nextDeadline() const
+{
+    std::lock_guard lock(m_);
+    return std::min(nextDue(), inner_->nextDeadline());
+}
+
+const LinkStats& LinkEmulator::txStats() const
+{
+    return tx_.stats_;
+}
+
+const LinkStats& LinkEmulator::rxStats() const
+{
+    return rx_.stats_;
+}
+
+}
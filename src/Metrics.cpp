@@ -0,0 +1,255 @@
+#include <Metrics.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace ustacktcp {
+
+size_t LatencyHistogram::bucketOf(uint64_t v)
+{
+    if (v < SUB_COUNT) return v;
+    int e = 63 - __builtin_clzll(v);
+    size_t sub = (v >> (e - SUB_BITS)) & (SUB_COUNT - 1);
+    return ((e - SUB_BITS + 1) << SUB_BITS) + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpper(size_t idx)
+{
+    if (idx < SUB_COUNT) return idx;
+    int e = (idx >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t sub = idx & (SUB_COUNT - 1);
+    uint64_t lo = (SUB_COUNT + sub) << (e - SUB_BITS);
+    return lo + (uint64_t(1) << (e - SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    counts_[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    total_.add();
+    sum_.add(ns);
+    uint64_t cur = max_.load(std::memory_order_relaxed);
+    while (ns > cur && !max_.compare_exchange_weak(cur, ns, std::memory_order_relaxed));
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration d)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    record(ns > 0 ? (uint64_t)ns : 0);
+}
+
+uint64_t LatencyHistogram::count() const { return total_.get(); }
+
+uint64_t LatencyHistogram::sum() const { return sum_.get(); }
+
+uint64_t LatencyHistogram::max() const { return max_.load(std::memory_order_relaxed); }
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t total = 0;
+    for (const auto& c : counts_) total += c.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+        seen += counts_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return std::min(bucketUpper(i), max());
+    }
+    return max();
+}
+
+const char* dropReasonName(DropReason r)
+{
+    switch (r)
+    {
+        case DROP_NOT_TCP: return "not_tcp";
+        case DROP_BAD_VERSION: return "bad_version";
+        case DROP_FOREIGN_PORT: return "foreign_port";
+        case DROP_NO_SOCKET: return "no_socket";
+        case DROP_FSM_REJECT: return "fsm_reject";
+        case DROP_TIME_WAIT: return "time_wait";
+        case DROP_RX_ERROR: return "rx_error";
+        case DROP_TX_ERROR: return "tx_error";
+        default: return "unknown";
+    }
+}
+
+namespace {
+
+struct NamedHistogram {
+    const char* name;
+    LatencyHistogram EngineMetrics::* h;
+};
+
+struct NamedCounter {
+    const char* name;
+    MetricCounter EngineMetrics::* c;
+};
+
+// exported by both formats, in this order
+constexpr NamedCounter COUNTERS[] = {
+    {"packets_in", &EngineMetrics::packets_in_}, {"bytes_in", &EngineMetrics::bytes_in_},
+    {"packets_out", &EngineMetrics::packets_out_}, {"bytes_out", &EngineMetrics::bytes_out_},
+    {"retransmits", &EngineMetrics::retransmits_}, {"timer_fires", &EngineMetrics::timer_fires_},
+    {"segment_allocs", &EngineMetrics::segment_allocs_}, {"sockets_reclaimed", &EngineMetrics::sockets_reclaimed_},
+    {"time_wait_reuses", &EngineMetrics::time_wait_reuses_}, {"fast_path", &EngineMetrics::fast_path_},
+    {"rx_coalesced", &EngineMetrics::rx_coalesced_}, {"gso_packets", &EngineMetrics::gso_packets_},
+    {"window_updates", &EngineMetrics::window_updates_}, {"window_probes", &EngineMetrics::window_probes_},
+    {"oow_acks", &EngineMetrics::oow_acks_}, {"fast_open_accepted", &EngineMetrics::fast_open_accepted_},
+    {"fast_open_cookies", &EngineMetrics::fast_open_cookies_}, {"fast_open_fallbacks", &EngineMetrics::fast_open_fallbacks_},
+    {"file_bytes", &EngineMetrics::file_bytes_}, {"file_chunks", &EngineMetrics::file_chunks_},
+};
+
+constexpr NamedHistogram HISTOGRAMS[] = {
+    {"rx_process_ns", &EngineMetrics::rx_process_ns_},
+    {"send_to_wire_ns", &EngineMetrics::send_to_wire_ns_},
+    {"wire_to_recv_ns", &EngineMetrics::wire_to_recv_ns_},
+};
+
+constexpr double QUANTILES[] = {50.0, 90.0, 99.0, 99.9};
+
+}
+
+std::string EngineMetrics::toPrometheus() const
+{
+    std::ostringstream out;
+    for (const auto& c : COUNTERS)
+    {
+        out << "# TYPE ustack_" << c.name << "_total counter\n";
+        out << "ustack_" << c.name << "_total " << (this->*c.c).get() << "\n";
+    }
+    out << "# TYPE ustack_drops_total counter\n";
+    for (size_t r = 0; r < DROP_REASON_COUNT; ++r)
+    {
+        out << "ustack_drops_total{reason=\"" << dropReasonName((DropReason)r) << "\"} " << drops_[r].get() << "\n";
+    }
+    for (const auto& nh : HISTOGRAMS)
+    {
+        const LatencyHistogram& h = this->*nh.h;
+        out << "# TYPE ustack_" << nh.name << " summary\n";
+        for (double q : QUANTILES)
+        {
+            out << "ustack_" << nh.name << "{quantile=\"" << q / 100.0 << "\"} " << h.percentile(q) << "\n";
+        }
+        out << "ustack_" << nh.name << "_sum " << h.sum() << "\n";
+        out << "ustack_" << nh.name << "_count " << h.count() << "\n";
+    }
+    return out.str();
+}
+
+std::string EngineMetrics::toJSON() const
+{
+    std::ostringstream out;
+    out << "{\"counters\":{";
+    for (size_t i = 0; i < std::size(COUNTERS); ++i)
+    {
+        out << (i ? "," : "") << "\"" << COUNTERS[i].name << "\":" << (this->*COUNTERS[i].c).get();
+    }
+    out << "},\"drops\":{";
+    for (size_t r = 0; r < DROP_REASON_COUNT; ++r)
+    {
+        out << (r ? "," : "") << "\"" << dropReasonName((DropReason)r) << "\":" << drops_[r].get();
+    }
+    out << "},\"histograms\":{";
+    for (size_t i = 0; i < std::size(HISTOGRAMS); ++i)
+    {
+        const LatencyHistogram& h = this->*HISTOGRAMS[i].h;
+        out << (i ? "," : "") << "\"" << HISTOGRAMS[i].name << "\":{\"count\":" << h.count()
+            << ",\"sum\":" << h.sum() << ",\"max\":" << h.max()
+            << ",\"p50\":" << h.percentile(50.0) << ",\"p90\":" << h.percentile(90.0)
+            << ",\"p99\":" << h.percentile(99.0) << ",\"p999\":" << h.percentile(99.9) << "}";
+    }
+    out << "}}\n";
+    return out.str();
+}
+
+MetricsExporter::MetricsExporter(const EngineMetrics& metrics, const MetricsExportOptions& opts)
+:   metrics_(metrics),
+    opts_(opts)
+{}
+
+bool MetricsExporter::writeFile(const std::string& body) const
+{
+    std::string tmp = opts_.path_ + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f)
+    {
+        perror("MetricsExporter::fopen");
+        return false;
+    }
+    bool ok = fwrite(body.data(), 1, body.size(), f) == body.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), opts_.path_.c_str()) < 0)
+    {
+        perror("MetricsExporter::write");
+        return false;
+    }
+    return true;
+}
+
+bool MetricsExporter::writeSocket(const std::string& body) const
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (opts_.path_.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, opts_.path_.c_str(), opts_.path_.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("MetricsExporter::socket");
+        return false;
+    }
+    bool ok = connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    size_t off = 0;
+    while (ok && off < body.size())
+    {
+        ssize_t n = write(fd, body.data() + off, body.size() - off);
+        if (n <= 0) ok = false;
+        else off += n;
+    }
+    close(fd);
+    return ok;
+}
+
+bool MetricsExporter::exportOnce() const
+{
+    std::string body = opts_.format_ == MetricsFormat::JSON ? metrics_.toJSON() : metrics_.toPrometheus();
+    return opts_.sink_ == MetricsSink::FILE ? writeFile(body) : writeSocket(body);
+}
+
+void MetricsExporter::start()
+{
+    thread_ = std::thread(&MetricsExporter::exportLoop, this);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    if (!thread_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+void MetricsExporter::exportLoop()
+{
+    std::unique_lock<std::mutex> lock(m_);
+    while (!cv_.wait_for(lock, opts_.interval_, [this]() { return stop_.load(); }))
+    {
+        lock.unlock();
+        exportOnce();
+        lock.lock();
+    }
+}
+
+}
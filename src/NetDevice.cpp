@@ -0,0 +1,256 @@
+#include <NetDevice.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <linux/filter.h>
+#include <algorithm>
+
+namespace ustacktcp {
+
+RxFilter RxFilter::build(const std::vector<SocketAddr>& local, size_t max_addrs, size_t max_ports)
+{
+    RxFilter f;
+    for (const auto& a : local)
+    {
+        f.addrs_.push_back(a.ip.addr);
+        f.ports_.push_back(a.port);
+    }
+    std::sort(f.addrs_.begin(), f.addrs_.end());
+    f.addrs_.erase(std::unique(f.addrs_.begin(), f.addrs_.end()), f.addrs_.end());
+    std::sort(f.ports_.begin(), f.ports_.end());
+    f.ports_.erase(std::unique(f.ports_.begin(), f.ports_.end()), f.ports_.end());
+    if (f.addrs_.size() > max_addrs) f.addrs_.clear();
+    if (f.ports_.size() > max_ports)
+    {
+        f.ports_ = {f.ports_.front(), f.ports_.back()};
+        f.port_range_ = true;
+    }
+    return f;
+}
+
+bool RxFilter::covers(const SocketAddr& addr) const
+{
+    if (!addrs_.empty() && !std::binary_search(addrs_.begin(), addrs_.end(), addr.ip.addr)) return false;
+    if (port_range_) return addr.port >= ports_.front() && addr.port <= ports_.back();
+    return std::binary_search(ports_.begin(), ports_.end(), addr.port);
+}
+
+RawSocketDevice::RawSocketDevice()
+{
+    fd_ = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+    if (fd_ < 0)
+    {
+        perror("RawSocketDevice::socket");
+        exit(1);
+    }
+    int on = 1;
+    if (setsockopt(fd_, IPPROTO_IP, IP_HDRINCL, &on, sizeof(on)) < 0)
+    {
+        perror("RawSocketDevice::setsockopt(IP_HDRINCL)");
+        exit(1);
+    }
+}
+
+RawSocketDevice::~RawSocketDevice()
+{
+    close(fd_);
+}
+
+ssize_t RawSocketDevice::transmit(const std::byte* pkt, size_t len)
+{
+    // the destination only picks the route; the header goes out as built
+    sockaddr_in to{};
+    to.sin_family = AF_INET;
+    memcpy(&to.sin_addr.s_addr, pkt + 16, sizeof(to.sin_addr.s_addr));
+    return sendto(fd_, pkt, len, 0, (sockaddr*)&to, sizeof(to));
+}
+
+ssize_t RawSocketDevice::receive(std::byte* buf, size_t len, bool nonblock)
+{
+    return recvfrom(fd_, buf, len, nonblock ? MSG_DONTWAIT : 0, nullptr, nullptr);
+}
+
+int RawSocketDevice::pollFd() const
+{
+    return fd_;
+}
+
+void RawSocketDevice::setBusyPoll(std::chrono::microseconds budget)
+{
+    // let the kernel busy-poll the device queue under our recvfrom as well
+    int usec = budget.count();
+    if (setsockopt(fd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+    {
+        perror("RawSocketDevice::setsockopt(SO_BUSY_POLL)");
+    }
+}
+
+bool RawSocketDevice::setFilter(const RxFilter& filter)
+{
+    // The program sees the packet from the IP header on. Jumps are
+    // forward-only with 8-bit offsets, so every match is followed by its
+    // own return instead of branching to a shared one.
+    constexpr uint32_t ACCEPT = 0xffffffff, DROP = 0;
+    std::vector<sock_filter> prog;
+    auto stmt = [&](uint16_t code, uint32_t k) { prog.push_back(BPF_STMT(code, k)); };
+    auto jump = [&](uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) { prog.push_back(BPF_JUMP(code, k, jt, jf)); };
+
+    if (filter.ports_.empty())
+    {
+        stmt(BPF_RET | BPF_K, DROP);
+    }
+    else
+    {
+        // later fragments carry no TCP header
+        stmt(BPF_LD | BPF_H | BPF_ABS, 6);
+        jump(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 0, 1);
+        stmt(BPF_RET | BPF_K, DROP);
+
+        if (!filter.addrs_.empty())
+        {
+            stmt(BPF_LD | BPF_W | BPF_ABS, 16);   // destination address
+            const uint32_t n = filter.addrs_.size();
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                jump(BPF_JMP | BPF_JEQ | BPF_K, filter.addrs_[i], 0, 1);
+                stmt(BPF_JMP | BPF_JA, 2 * (n - i) - 1);  // past the DROP below
+            }
+            stmt(BPF_RET | BPF_K, DROP);
+        }
+
+        stmt(BPF_LDX | BPF_B | BPF_MSH, 0);        // X = IP header length
+        stmt(BPF_LD | BPF_H | BPF_IND, 2);         // destination port
+        if (filter.port_range_)
+        {
+            jump(BPF_JMP | BPF_JGE | BPF_K, filter.ports_.front(), 0, 2);
+            jump(BPF_JMP | BPF_JGT | BPF_K, filter.ports_.back(), 1, 0);
+            stmt(BPF_RET | BPF_K, ACCEPT);
+        }
+        else
+        {
+            for (uint16_t port : filter.ports_)
+            {
+                jump(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1);
+                stmt(BPF_RET | BPF_K, ACCEPT);
+            }
+        }
+        stmt(BPF_RET | BPF_K, DROP);
+    }
+
+    if (prog.size() > BPF_MAXINSNS)
+    {
+        fprintf(stderr, "RawSocketDevice::setFilter: %zu instructions, keeping the previous filter\n", prog.size());
+        return filtered_;
+    }
+    sock_fprog fprog{(unsigned short)prog.size(), prog.data()};
+    // replaces the previous program atomically
+    if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+    {
+        perror("RawSocketDevice::setsockopt(SO_ATTACH_FILTER)");
+        return filtered_;
+    }
+    if (!filtered_)
+    {
+        // whatever was queued before the first filter went on
+        std::byte scratch[65536];
+        while (recvfrom(fd_, scratch, sizeof(scratch), MSG_DONTWAIT, nullptr, nullptr) >= 0);
+        filtered_ = true;
+    }
+    return true;
+}
+
+PipeDevice::PipeDevice(std::shared_ptr<Queue> rx, std::shared_ptr<Queue> tx, size_t limit)
+:   rx_(std::move(rx)),
+    tx_(std::move(tx)),
+    limit_(limit)
+{}
+
+PipeDevice::Queue::~Queue()
+{
+    if (efd_ >= 0) close(efd_);
+}
+
+std::pair<std::shared_ptr<PipeDevice>, std::shared_ptr<PipeDevice>> PipeDevice::makePair(size_t queue_packets)
+{
+    auto q1 = std::make_shared<Queue>(), q2 = std::make_shared<Queue>();
+    for (auto* q : {q1.get(), q2.get()})
+    {
+        q->efd_ = eventfd(0, EFD_NONBLOCK);
+        if (q->efd_ < 0)
+        {
+            perror("PipeDevice::eventfd");
+            exit(1);
+        }
+    }
+    std::shared_ptr<PipeDevice> a(new PipeDevice(q1, q2, queue_packets));
+    std::shared_ptr<PipeDevice> b(new PipeDevice(q2, q1, queue_packets));
+    return {a, b};
+}
+
+ssize_t PipeDevice::transmit(const std::byte* pkt, size_t len)
+{
+    std::vector<std::byte> copy(pkt, pkt + len);
+    std::lock_guard lock(tx_->m_);
+    if (tx_->q_.size() >= limit_)
+    {
+        drops_.add();
+        return len;
+    }
+    tx_->q_.push_back(std::move(copy));
+    if (tx_->q_.size() == 1)
+    {
+        uint64_t one = 1;
+        ::write(tx_->efd_, &one, sizeof(one));
+    }
+    return len;
+}
+
+ssize_t PipeDevice::receive(std::byte* buf, size_t len, bool nonblock)
+{
+    while (true)
+    {
+        {
+            std::lock_guard lock(rx_->m_);
+            if (!rx_->q_.empty())
+            {
+                auto& pkt = rx_->q_.front();
+                size_t n = std::min(len, pkt.size());
+                memcpy(buf, pkt.data(), n);
+                rx_->q_.pop_front();
+                if (rx_->q_.empty())
+                {
+                    uint64_t v;
+                    ::read(rx_->efd_, &v, sizeof(v));
+                }
+                return n;
+            }
+        }
+        if (nonblock)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        pollfd pfd{rx_->efd_, POLLIN, 0};
+        ::poll(&pfd, 1, -1);
+    }
+}
+
+int PipeDevice::pollFd() const
+{
+    return rx_->efd_;
+}
+
+uint64_t PipeDevice::drops() const
+{
+    return drops_.get();
+}
+
+}
\ No newline at end of file
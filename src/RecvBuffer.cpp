@@ -5,119 +5,156 @@
 
 namespace ustacktcp {
 
-RecvBuffer::RecvBuffer() 
-{
-    tail_ = 0;
-    head_ = 0;
-    buf_ = new std::byte[sz_];
-}
+RecvBuffer::RecvBuffer(BufferPool* pool) : ring_(sz_, pool) {}
 
 void RecvBuffer::setIRS(const uint32_t irs)
 {
-    ack_ = irs;
+    // the SYN takes one sequence number
+    ack_ = irs + 1;
 }
 
-size_t RecvBuffer::getSize() const
+bool RecvBuffer::insertRange(uint32_t s, uint32_t e)
 {
-    return (tail_ + sz_ - head_) % sz_;
+    // [lo, hi) are the ranges that touch or overlap [s, e)
+    size_t lo = 0;
+    while (lo < q_len_ && SEQ_LT(q_[lo].end_, s)) ++lo;
+    size_t hi = lo;
+    while (hi < q_len_ && SEQ_LEQ(q_[hi].start_, e))
+    {
+        if (SEQ_LT(q_[hi].start_, s)) s = q_[hi].start_;
+        if (SEQ_GT(q_[hi].end_, e)) e = q_[hi].end_;
+        ++hi;
+    }
+    if (hi == lo && q_len_ == MAX_OOO_RANGES) return false;
+    // collapse [lo, hi) into one slot
+    size_t removed = hi - lo;
+    if (removed != 1)
+    {
+        std::memmove(&q_[lo + 1], &q_[hi], (q_len_ - hi) * sizeof(Range));
+        q_len_ = q_len_ - removed + 1;
+    }
+    q_[lo] = {s, e};
+    return true;
 }
 
-size_t RecvBuffer::getAvailSize() const
+void RecvBuffer::advance(size_t tail, uint32_t new_ack)
 {
-    return sz_ - getSize() - 1;
+    if (rx_mark_pos_.load(std::memory_order_relaxed) == 0)
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        rx_mark_ns_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), std::memory_order_relaxed);
+        rx_mark_pos_.store(tail + (new_ack - ack_), std::memory_order_release);
+    }
+    ring_.publish(tail + (new_ack - ack_));
+    stat_bytes_received_.add(new_ack - ack_);
+    ack_ = new_ack;
 }
 
-ssize_t RecvBuffer::enqueue(const std::byte* data, const size_t len, const uint32_t seq_num, const uint8_t flags)
+bool RecvBuffer::inSequence(const uint32_t seq_num, const size_t len) const
 {
-    if (len > getAvailSize()) return -1; //FIXME: handle error
-
-    uint32_t s = seq_num, e = s + len;
-    if (flags & TCPFlag::SYN || flags & TCPFlag::FIN) e++;
-    size_t new_len = len;
-    std::byte* new_data = const_cast<std::byte*>(data);
+    return seq_num == ack_ && q_len_ == 0 && !fin_pending_ && len <= ring_.writable();
+}
 
-    auto it = q_.lower_bound(s);
-    if (it != q_.begin()) --it;
+void RecvBuffer::append(const std::byte* data, const size_t len)
+{
+    size_t tail = ring_.tail();
+    ring_.hold();
+    ring_.writeAt(tail, data, len);
+    advance(tail, ack_ + len);
+    ring_.unhold();
+}
 
-    while (it != q_.end())
+ssize_t RecvBuffer::enqueue(const std::byte* data, const size_t len, const uint32_t seq_num, const uint8_t flags)
+{
+    uint32_t s = seq_num;
+    if (flags & TCPFlag::SYN)
+    {
+        if (s == ack_) ++ack_;
+        ++s;
+    }
+    uint32_t e = s + len;
+    if (flags & TCPFlag::FIN && !fin_rcvd_)
     {
-        uint32_t es = it->second->seq_start_, ee = es + it->second->len_;
-        if (it->second->flags_ & TCPFlag::SYN || it->second->flags_ & TCPFlag::FIN) ee++;
+        fin_seq_ = e;
+        fin_pending_ = true;
+    }
 
-        if (SEQ_LEQ(ee, s))
-        {
-            ++it;
-            continue;
-        }
-        if (SEQ_GEQ(es, e)) break;
+    // clip to [ack_, right window edge)
+    size_t tail = ring_.tail();
+    uint32_t wnd_end = ack_ + ring_.writable();
+    uint32_t cs = SEQ_GT(ack_, s) ? ack_ : s;
+    uint32_t ce = SEQ_LT(wnd_end, e) ? wnd_end : e;
 
-        if (SEQ_LEQ(es, s) && SEQ_GEQ(ee, e)) return len;
-        if (SEQ_LEQ(es, s) && SEQ_GT(ee, e))
+    if (SEQ_LT(cs, ce))
+    {
+        ring_.hold();
+        ring_.writeAt(tail + (cs - ack_), data + (cs - s), ce - cs);
+        if (cs == ack_)
         {
-            uint32_t delta = ee - s;
-            s   += delta;
-            new_len -= delta;
-            if (new_len > 0) new_data += delta;
-            ++it;
-            continue;
+            uint32_t new_ack = ce;
+            // cascading ack
+            size_t merged = 0;
+            while (merged < q_len_ && SEQ_LEQ(q_[merged].start_, new_ack))
+            {
+                if (SEQ_GT(q_[merged].end_, new_ack)) new_ack = q_[merged].end_;
+                ++merged;
+            }
+            if (merged > 0)
+            {
+                std::memmove(&q_[0], &q_[merged], (q_len_ - merged) * sizeof(Range));
+                q_len_ -= merged;
+            }
+            advance(tail, new_ack);
         }
-        if (SEQ_GT(es, s) && SEQ_LT(es, e))
+        else
         {
-            new_len = es - s;
-            e   = s + new_len;
-            break;
+            // if the range table is full the bytes stay untracked until retransmitted
+            insertRange(cs, ce);
         }
-
-        ++it;
+        if (q_len_ == 0) ring_.unhold();
     }
 
-    if (new_len == 0 && !(flags & TCPFlag::SYN) && !(flags & TCPFlag::FIN)) return len;
-
-    auto firstBlockStart = buf_ + tail_;
-    auto firstBlockSize = std::min(new_len, sz_-tail_);
-    memcpy(firstBlockStart, data, firstBlockSize);
-    if (firstBlockSize < new_len)
-    {
-        memcpy(buf_, data + firstBlockSize, new_len - firstBlockSize);
-    }
-    tail_ = (tail_ + new_len) % sz_;
-
-    const auto p = std::make_shared<TCPSegment>(
-        data,
-        buf_,
-        s,
-        new_len,
-        firstBlockSize,
-        flags
-    );
-    
-    auto [rit, inserted] = q_.emplace(s, p);
-    if (!inserted) return -1; // TODO: handle error
-
-    // cascading ack
-    while (rit != q_.end() && rit->second->seq_start_ == ack_)
+    if (fin_pending_ && ack_ == fin_seq_)
     {
-        ack_ += rit->second->len_;
-        if (rit->second->flags_ & TCPFlag::SYN || rit->second->flags_ & TCPFlag::FIN) ++ack_;
-        ++rit;
+        ++ack_;
+        fin_pending_ = false;
+        fin_rcvd_ = true;
     }
-    
+
     return len;
 }
 
 ssize_t RecvBuffer::dequeue(std::byte* dest, const size_t len)
 {
-    size_t copySz = 0;
-    while (availableData() && q_.begin()->second->len_ <= len - copySz)
-    {
-        const auto p = q_.begin()->second;
-        memcpy(dest + copySz, p->data_, p->brk_len_);
-        copySz += p->brk_len_;
-        memcpy(dest + copySz, p->data2_, p->len_ - p->brk_len_);
-        copySz += p->len_ - p->brk_len_;
-        q_.erase(q_.begin());
-    }
-    return copySz;
+    size_t n = ring_.read(dest, len);
+    if (n > 0 && ring_.readable() == 0) ring_.trim();
+    return n;
+}
+
+const SPSCByteRing& RecvBuffer::ring() const
+{
+    return ring_;
+}
+
+void RecvBuffer::release(const size_t len)
+{
+    ring_.release(len);
+    if (ring_.readable() == 0) ring_.trim();
+}
+
+bool RecvBuffer::finReceived() const
+{
+    return fin_rcvd_;
+}
+
+std::optional<std::chrono::steady_clock::duration> RecvBuffer::takeLatencySample()
+{
+    size_t mark = rx_mark_pos_.load(std::memory_order_acquire);
+    if (mark == 0 || ring_.head() < mark) return std::nullopt;
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    auto lat = std::chrono::nanoseconds(now - rx_mark_ns_.load(std::memory_order_relaxed));
+    rx_mark_pos_.store(0, std::memory_order_release);
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(lat);
 }
 
 uint32_t RecvBuffer::getAckNumber() const
@@ -125,16 +162,36 @@ uint32_t RecvBuffer::getAckNumber() const
     return ack_;
 }
 
-bool RecvBuffer::availableData()
+bool RecvBuffer::availableData() const
 {
-    auto first = q_.begin();
-    if (!q_.empty() && first->second->flags_ & TCPFlag::SYN && first->second->seq_start_ < ack_) first = q_.erase(first); // remove initial syn
-    return !q_.empty() && !(first->second->flags_ & TCPFlag::SYN) && !(first->second->flags_ & TCPFlag::FIN) && first->second->seq_start_ < ack_;
+    return ring_.readable() > 0;
 }
 
 uint16_t RecvBuffer::getWindowSize() const
 {
-    return getAvailSize();
+    return std::min<size_t>(ring_.writable(), UINT16_MAX);
+}
+
+uint16_t RecvBuffer::advertiseWindow()
+{
+    uint16_t wnd = getWindowSize();
+    adv_edge_.store(ring_.tail() + wnd, std::memory_order_relaxed);
+    return wnd;
+}
+
+bool RecvBuffer::windowUpdateDue() const
+{
+    const size_t tail = ring_.tail();
+    const size_t adv = adv_edge_.load(std::memory_order_relaxed);
+    const size_t left = adv > tail ? adv - tail : 0;
+    const size_t wnd = std::min<size_t>(ring_.capacity() - (tail - ring_.head()), UINT16_MAX);
+    return wnd >= 2 * left && wnd - left >= std::min(ring_.capacity() / 2, TCP_MSS);
+}
+
+void RecvBuffer::fillInfo(TCPInfo& info) const
+{
+    info.bytes_received_ = stat_bytes_received_.get();
+    info.rcv_wnd_ = getWindowSize();
 }
 
 }
\ No newline at end of file
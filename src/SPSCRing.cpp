@@ -0,0 +1,167 @@
+#include <SPSCRing.hpp>
+#include <BufferPool.hpp>
+#include <types.hpp>
+
+#include <cstring>
+#include <algorithm>
+
+namespace ustacktcp {
+
+SPSCByteRing::SPSCByteRing(size_t cap, BufferPool* pool) : pool_(pool), cap_(cap), mask_(cap - 1) {}
+
+SPSCByteRing::~SPSCByteRing()
+{
+    std::byte* b = block();
+    if (!b) return;
+    if (pool_) pool_->release(b);
+    else delete[] b;
+}
+
+std::byte* SPSCByteRing::block() const
+{
+    return reinterpret_cast<std::byte*>(buf_.load(std::memory_order_acquire) & ~(HELD | TRIMMING));
+}
+
+bool SPSCByteRing::attached() const
+{
+    return buf_.load(std::memory_order_relaxed) != 0;
+}
+
+void SPSCByteRing::hold()
+{
+    uintptr_t b = buf_.load(std::memory_order_relaxed);
+    if (b & HELD) return;
+    for (;;)
+    {
+        // a trim() in progress decides within a few instructions
+        if (b & TRIMMING)
+        {
+            cpuRelax();
+            b = buf_.load(std::memory_order_relaxed);
+            continue;
+        }
+        if (b == 0) break;
+        if (buf_.compare_exchange_weak(b, b | HELD, std::memory_order_acquire, std::memory_order_relaxed)) return;
+    }
+    // only the producer attaches, so nothing else can replace the 0
+    std::byte* fresh = pool_ ? pool_->acquire() : new std::byte[cap_];
+    buf_.store(reinterpret_cast<uintptr_t>(fresh) | HELD, std::memory_order_release);
+}
+
+void SPSCByteRing::unhold()
+{
+    // publishes the tail stores of this write session to trim()
+    buf_.store(buf_.load(std::memory_order_relaxed) & ~HELD, std::memory_order_release);
+    // the consumer may have drained it all while the block was held
+    if (head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed)) trim();
+}
+
+bool SPSCByteRing::trim()
+{
+    uintptr_t b = buf_.load(std::memory_order_acquire);
+    if (b == 0 || (b & (HELD | TRIMMING))) return false;
+    if (tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_acquire)) return false;
+    // A whole write session can run between the check above and a CAS on
+    // b and leave buf_ unchanged, so the check alone proves nothing. Claim
+    // the block first, which keeps hold() out, and check again: every
+    // session that got in before the claim has published its tail by now.
+    if (!buf_.compare_exchange_strong(b, b | TRIMMING, std::memory_order_acq_rel)) return false;
+    // either side may trim, so both counters are acquired
+    if (tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_acquire))
+    {
+        buf_.store(b, std::memory_order_release);
+        return false;
+    }
+    buf_.store(0, std::memory_order_release);
+    std::byte* p = reinterpret_cast<std::byte*>(b);
+    if (pool_) pool_->release(p);
+    else delete[] p;
+    return true;
+}
+
+size_t SPSCByteRing::capacity() const
+{
+    return cap_;
+}
+
+size_t SPSCByteRing::writable() const
+{
+    return cap_ - (tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire));
+}
+
+void SPSCByteRing::writeAt(size_t pos, const std::byte* data, size_t len)
+{
+    std::byte* buf = block();
+    size_t off = pos & mask_;
+    size_t first = std::min(len, cap_ - off);
+    memcpy(buf + off, data, first);
+    if (first < len) memcpy(buf, data + first, len - first);
+}
+
+void SPSCByteRing::publish(size_t tail)
+{
+    tail_.store(tail, std::memory_order_release);
+}
+
+size_t SPSCByteRing::write(const std::byte* data, size_t len)
+{
+    size_t n = std::min(len, writable());
+    if (n == 0) return 0;
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    hold();
+    writeAt(tail, data, n);
+    publish(tail + n);
+    unhold();
+    return n;
+}
+
+size_t SPSCByteRing::readable() const
+{
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
+}
+
+size_t SPSCByteRing::read(std::byte* dest, size_t len)
+{
+    size_t n = std::min(len, readable());
+    if (n == 0) return 0;
+    std::byte* buf = block();
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t off = head & mask_;
+    size_t first = std::min(n, cap_ - off);
+    memcpy(dest, buf + off, first);
+    if (first < n) memcpy(dest + first, buf, n - first);
+    release(n);
+    return n;
+}
+
+void SPSCByteRing::release(size_t n)
+{
+    head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+size_t SPSCByteRing::head() const
+{
+    return head_.load(std::memory_order_acquire);
+}
+
+size_t SPSCByteRing::tail() const
+{
+    return tail_.load(std::memory_order_acquire);
+}
+
+const std::byte* SPSCByteRing::at(size_t pos) const
+{
+    return block() + (pos & mask_);
+}
+
+const std::byte* SPSCByteRing::data() const
+{
+    return block();
+}
+
+size_t SPSCByteRing::contiguous(size_t pos) const
+{
+    return cap_ - (pos & mask_);
+}
+
+}
@@ -0,0 +1,121 @@
+#include <SegmentCoalescer.hpp>
+
+#include <cstring>
+#include <arpa/inet.h>
+
+#include <types.hpp>
+
+namespace ustacktcp {
+
+namespace {
+
+constexpr size_t IP_HDR = 20;
+constexpr size_t MAX_PACKET = 65535;
+
+uint16_t load16(const std::byte* p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+uint32_t load32(const std::byte* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+void store16(std::byte* p, uint16_t v)
+{
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+size_t tcpHeaderLength(const std::byte* pkt)
+{
+    return (std::to_integer<uint8_t>(pkt[IP_HDR + 12]) >> 4) * 4;
+}
+
+}
+
+SegmentCoalescer::SegmentCoalescer() : pkt_(MAX_PACKET) {}
+
+bool SegmentCoalescer::eligible(const std::byte* pkt, size_t len)
+{
+    if (len < IP_HDR + 20) return false;
+    if (std::to_integer<uint8_t>(pkt[0]) != 0x45) return false;       // v4, no options
+    if (std::to_integer<uint8_t>(pkt[9]) != IPPROTO_TCP) return false;
+    if (load16(pkt + 6) & 0x3FFF) return false;                        // MF or offset
+    if (load16(pkt + 2) != len) return false;
+    const size_t th = tcpHeaderLength(pkt);
+    if (th < 20 || IP_HDR + th >= len) return false;                   // no payload
+    return (std::to_integer<uint8_t>(pkt[IP_HDR + 13]) & ~TCPFlag::PSH) == TCPFlag::ACK;
+}
+
+bool SegmentCoalescer::extends(const std::byte* pkt, size_t len) const
+{
+    const std::byte* held = pkt_.data();
+    if (IP_HDR + tcpHeaderLength(pkt) != hdr_len_) return false;
+    if (len_ + (len - hdr_len_) > MAX_PACKET) return false;
+    if (load32(pkt + IP_HDR + 4) != next_seq_) return false;
+    return pkt[1] == held[1]                                           // TOS, ECN marks
+        && memcmp(pkt + 12, held + 12, 8) == 0                         // addresses
+        && memcmp(pkt + IP_HDR, held + IP_HDR, 4) == 0                 // ports
+        && memcmp(pkt + IP_HDR + 8, held + IP_HDR + 8, 4) == 0         // ACK number
+        && memcmp(pkt + IP_HDR + 20, held + IP_HDR + 20, hdr_len_ - IP_HDR - 20) == 0;
+}
+
+bool SegmentCoalescer::add(const std::byte* pkt, size_t len)
+{
+    if (!eligible(pkt, len)) return false;
+    if (len_ == 0)
+    {
+        memcpy(pkt_.data(), pkt, len);
+        len_ = len;
+        segs_ = 1;
+        hdr_len_ = IP_HDR + tcpHeaderLength(pkt);
+        next_seq_ = load32(pkt + IP_HDR + 4) + (len - hdr_len_);
+        return true;
+    }
+    if (!extends(pkt, len)) return false;
+
+    const size_t payload = len - hdr_len_;
+    memcpy(pkt_.data() + len_, pkt + hdr_len_, payload);
+    len_ += payload;
+    segs_++;
+    next_seq_ += payload;
+    std::byte* held = pkt_.data();
+    store16(held + 2, len_);
+    held[IP_HDR + 13] |= pkt[IP_HDR + 13] & std::byte{TCPFlag::PSH};
+    memcpy(held + IP_HDR + 14, pkt + IP_HDR + 14, 2);                  // newest window
+    return true;
+}
+
+bool SegmentCoalescer::empty() const
+{
+    return len_ == 0;
+}
+
+const std::byte* SegmentCoalescer::data() const
+{
+    return pkt_.data();
+}
+
+size_t SegmentCoalescer::size() const
+{
+    return len_;
+}
+
+size_t SegmentCoalescer::segments() const
+{
+    return segs_;
+}
+
+void SegmentCoalescer::clear()
+{
+    len_ = 0;
+    segs_ = 0;
+}
+
+}
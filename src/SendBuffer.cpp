@@ -1,9 +1,15 @@
 #include <cstring>
 #include <algorithm>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <SendBuffer.hpp>
 #include <TCPEngine.hpp>
+#include <StreamSocket.hpp>
+#include <Metrics.hpp>
 
 namespace ustacktcp {
 
@@ -24,103 +30,406 @@ bool SendBuffer::canSend(const size_t n) const
     return (in_flight_sz_ + n <= std::min(rcvwnd_,cwnd_));
 }
 
-size_t SendBuffer::getAvailSize() const
+void SendBuffer::setLimit(SendLimit limit, const std::chrono::steady_clock::time_point now)
 {
-    return sz_ - getSize() - 1;
+    if (limit == limit_) return;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - limit_since_).count();
+    if (limit_ == RWND_LIMITED) stat_rwnd_limited_ns_.add(ns);
+    else if (limit_ == CWND_LIMITED) stat_cwnd_limited_ns_.add(ns);
+    limit_ = limit;
+    limit_since_ = now;
+    stat_limit_since_ns_.set(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+    stat_limit_.set(limit);
 }
-    
-size_t SendBuffer::getSize() const
-{
-    return (tail_ + sz_ - head_) % sz_;
-}
-    
-bool SendBuffer::isEmpty() const
+
+void SendBuffer::publishGauges()
 {
-    return tail_ == head_;
+    stat_srtt_us_.set(std::chrono::duration_cast<std::chrono::microseconds>(srtt_).count());
+    stat_rttvar_us_.set(std::chrono::duration_cast<std::chrono::microseconds>(rttvar_).count());
+    stat_rto_us_.set(std::chrono::duration_cast<std::chrono::microseconds>(rto_).count());
+    stat_cwnd_.set(cwnd_);
+    stat_ssthresh_.set(ssthresh_);
+    stat_in_flight_.set(in_flight_sz_);
 }
-    
-bool SendBuffer::isFull() const
+
+void SendBuffer::splitSegment(SegmentList& q, TCPSegment* p, size_t at)
 {
-    return (tail_ + 1) % sz_ == head_;
+    engine_.metrics().segment_allocs_.add();
+    TCPSegment* rest = engine_.segmentPool().acquire(p->data_, p->data2_, p->seq_start_, p->len_, p->brk_len_, p->flags_);
+    rest->source_ = p->source_;
+    rest->retransmit_cnt_ = p->retransmit_cnt_;
+    rest->send_tmstp_ = p->send_tmstp_;
+    rest->advance(at);
+    p->len_ = at;
+    p->brk_len_ = std::min<uint32_t>(p->brk_len_, at);
+    q.insert_after(p, rest);
 }
 
-void SendBuffer::sendSegments()
+void SendBuffer::sendSegments(bool force)
 {
-    if (next_q_.empty()) return;
+    if (next_q_.empty() && file_.fd_ < 0) return;
     
-    while (!next_q_.empty() && canSend(next_q_.top()->len_ - sizeof(TCPHeader)))
+    while (true)
     {
-        std::shared_ptr<TCPSegment> p = next_q_.top();
+        if (next_q_.empty() && file_.fd_ >= 0) segmentQueued(0);
+        if (next_q_.empty()) break;
+        TCPSegment* p = next_q_.front();
+        if ((p->flags_ & TCPFlag::SYN) && syn_opts_.fast_open_)
+        {
+            sendSyn(p);
+            continue;
+        }
+        if (!canSend(p->len_))
+        {
+            const size_t wnd = std::min(rcvwnd_, cwnd_);
+            const size_t usable = wnd > in_flight_sz_ ? wnd - in_flight_sz_ : 0;
+            size_t fit = usable / MSS * MSS;
+            // sender-side silly window avoidance
+            if (fit == 0 && (force || usable >= max_rcvwnd_ / 2)) fit = usable;
+            if (fit == 0) break;
+            splitSegment(next_q_, p, fit);
+        }
+        force = false;
         // send logic
         if (in_flight_q_.empty()) restartRTO();
-        next_q_.pop();
-        in_flight_sz_ += (p->len_ - sizeof(TCPHeader));
-        in_flight_q_.push(p);
-        engine_.send(p, local_addr_, peer_addr_, recv_buf_);
+        persist_armed_ = false;
+        next_q_.pop_front();
+        in_flight_sz_ += p->len_;
+        in_flight_q_.push_back(p);
+        engine_.send(*p, tmpl_, recv_buf_);
+        stat_bytes_sent_.add(p->len_);
+        if (tx_mark_armed_ && SEQ_LEQ(p->seq_start_, tx_mark_seq_) && SEQ_LT(tx_mark_seq_, p->seq_start_ + p->len_))
+        {
+            auto sent_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            engine_.metrics().send_to_wire_ns_.record(std::max<int64_t>(0, sent_ns - tx_mark_ns_.load(std::memory_order_relaxed)));
+            tx_mark_armed_ = false;
+            tx_mark_pos_.store(0, std::memory_order_release);
+        }
+    }
+
+    SendLimit limit = NOT_LIMITED;
+    if (!next_q_.empty()) limit = rcvwnd_ <= cwnd_ ? RWND_LIMITED : CWND_LIMITED;
+    if (!next_q_.empty() && in_flight_q_.empty() && !persist_armed_)
+    {
+        // nothing left to bring an ACK: probe the window until it opens
+        persist_armed_ = true;
+        persist_backoff_ = rto_;
+        persist_expiry_ = engine_.now() + persist_backoff_;
+        if (owner_) engine_.armTimer(owner_, persist_expiry_);
+    }
+    setLimit(limit, engine_.now());
+    publishGauges();
+}
+
+void SendBuffer::sendSyn(TCPSegment* syn)
+{
+    if (in_flight_q_.empty()) restartRTO();
+    next_q_.pop_front();
+    in_flight_q_.push_back(syn);
+    TCPSegment wire = *syn;
+    TCPSegment* data = next_q_.front();
+    // the peer's window is not known yet; RFC 7413 allows one MSS
+    if (!(syn->flags_ & TCPFlag::ACK) && syn_opts_.cookie_len_ > 0 && data && data->len_ > 0)
+    {
+        if (data->len_ > MSS) splitSegment(next_q_, data, MSS);
+        next_q_.pop_front();
+        in_flight_sz_ += data->len_;
+        in_flight_q_.push_back(data);
+        wire.data_ = data->data_;
+        wire.data2_ = data->data2_;
+        wire.len_ = data->len_;
+        wire.brk_len_ = data->brk_len_;
+        syn_data_ = true;
     }
+    engine_.send(wire, tmpl_, recv_buf_, syn_opts_);
+    syn->send_tmstp_ = wire.send_tmstp_;
+    if (syn_data_)
+    {
+        data->send_tmstp_ = wire.send_tmstp_;
+        stat_bytes_sent_.add(data->len_);
+    }
+}
+
+SendBuffer::SendBuffer(TCPEngine& engine, RecvBuffer& recv_buf, StreamSocket* owner) 
+:   ring_(sz_, &engine.bufferPool()),
+    engine_(engine),
+    recv_buf_(recv_buf),
+    owner_(owner),
+    seg_max_(engine.maxSegment())
+{}
+
+SendBuffer::~SendBuffer()
+{
+    auto& pool = engine_.segmentPool();
+    while (!in_flight_q_.empty()) pool.release(in_flight_q_.pop_front());
+    while (!next_q_.empty()) pool.release(next_q_.pop_front());
+    for (auto& c : chunks_) munmap(c.map_, c.map_len_);
+    if (file_.fd_ >= 0) ::close(file_.fd_);
+    for (auto& f : files_) ::close(f.fd_);
+}
+
+void SendBuffer::setLocalAddr(const SocketAddr& local_addr)
+{
+    local_addr_ = local_addr;
+    engine_.initTemplate(tmpl_, local_addr_, peer_addr_);
+}
+
+void SendBuffer::setPeerAddr(const SocketAddr& peer_addr)
+{
+    peer_addr_ = peer_addr;
+    engine_.initTemplate(tmpl_, local_addr_, peer_addr_);
+}
+
+const PacketTemplate& SendBuffer::headerTemplate() const
+{
+    return tmpl_;
+}
+
+void SendBuffer::setSynOptions(const TCPOptions& opts)
+{
+    syn_opts_ = opts;
 }
 
-SendBuffer::SendBuffer(TCPEngine& engine, RecvBuffer& recv_buf) 
-:   engine_(engine),
-    recv_buf_(recv_buf)
+void SendBuffer::setSpliceSource(StreamSocket* src, size_t pos)
 {
-    buf_ = new std::byte[sz_]; // FIXME: hardcoded max size
-    head_ = 0;
-    tail_ = 0;
+    splice_src_ = src;
+    splice_pos_ = pos;
 }
 
-void SendBuffer::setLocalAddr(const SocketAddr& local_addr) { local_addr_ = local_addr; }
+bool SendBuffer::synDataRejected() const
+{
+    return syn_data_rejected_;
+}
 
-void SendBuffer::setPeerAddr(const SocketAddr& peer_addr) { peer_addr_ = peer_addr; }
+void SendBuffer::setRcvWnd(const uint16_t rcvwnd)
+{
+    rcvwnd_ = rcvwnd;
+    max_rcvwnd_ = std::max(max_rcvwnd_, rcvwnd_);
+    stat_rcvwnd_.set(rcvwnd);
+}
 
-void SendBuffer::setRcvWnd(const uint16_t rcvwnd) { rcvwnd_ = rcvwnd; };
+void SendBuffer::windowUpdate(const uint16_t rcvwnd, const uint32_t seq, const uint32_t ack)
+{
+    // RFC 793 SND.WL1/WL2: a reordered older segment does not move the
+    // window, which it gave relative to an older ACK
+    if (wnd_set_ && (SEQ_LT(seq, wnd_seq_) || (seq == wnd_seq_ && SEQ_LT(ack, wnd_ack_)))) return;
+    wnd_set_ = true;
+    wnd_seq_ = seq;
+    wnd_ack_ = ack;
+    const bool opened = rcvwnd > rcvwnd_;
+    setRcvWnd(rcvwnd);
+    if (opened) sendSegments();
+}
 
 const uint32_t SendBuffer::getSeqNumber() const
 {
-    return next_seq_num_;
+    return next_q_.empty() ? next_seq_num_ : next_q_.front()->seq_start_;
 }
 
-ssize_t SendBuffer::enqueue(const std::byte* data, size_t len, const uint8_t flags)
+void SendBuffer::setISS(const uint32_t iss)
 {
-    // TODO: allow options
-    auto availSize = getAvailSize();
-    auto headrSz = sizeof(TCPHeader);
-    if (availSize < len + headrSz) return -1; //FIXME: handle error
-    auto firstBlockStart = buf_ + tail_;
-    auto firstBlockSize = std::min(headrSz,sz_-tail_);
-    tail_ = (tail_ + headrSz) % sz_;
-    auto secondBlockStart = buf_ + tail_;
-    auto secondBlockSize = std::min(len,sz_-tail_);
-    memcpy(secondBlockStart, data, secondBlockSize);
+    next_seq_num_ = iss;
+    ack_num_ = iss;
+}
 
-    size_t brk_len;
-    if (firstBlockSize < headrSz) brk_len = firstBlockSize;
-    else if (secondBlockSize < len)
+size_t SendBuffer::write(const std::byte* data, size_t len)
+{
+    size_t n = ring_.write(data, len);
+    if (n > 0 && tx_mark_pos_.load(std::memory_order_acquire) == 0)
     {
-        brk_len = headrSz + secondBlockSize;
-        memcpy(buf_, data + secondBlockSize, len - secondBlockSize);
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        tx_mark_ns_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), std::memory_order_relaxed);
+        tx_mark_pos_.store(ring_.tail(), std::memory_order_release);
     }
-    else brk_len = len + headrSz;
+    return n;
+}
 
-    tail_ = (tail_ + len) % sz_;
+size_t SendBuffer::writable() const
+{
+    return ring_.writable();
+}
 
+size_t SendBuffer::capacity() const
+{
+    return ring_.capacity();
+}
 
+ssize_t SendBuffer::writeFile(int fd, off_t offset, size_t len)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("fstat");
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || offset < 0 || (uint64_t)st.st_size < (uint64_t)offset + len) return -1;
+    if (len == 0) return 0;
+    // ours to close once sent, whatever the caller does with fd
+    int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own < 0)
+    {
+        perror("fcntl");
+        return -1;
+    }
+    {
+        std::lock_guard lock(files_m_);
+        files_.push_back({ring_.tail(), own, offset, len});
+    }
+    files_queued_.fetch_add(1, std::memory_order_release);
+    engine_.metrics().file_bytes_.add(len);
+    return len;
+}
 
-    std::shared_ptr<TCPSegment> p = std::make_shared<TCPSegment>(
-        firstBlockStart,
-        buf_,
-        next_seq_num_,
-        len + headrSz,
-        brk_len,
-        flags
-    );
+void SendBuffer::segmentRing(const SPSCByteRing& ring, size_t& pos, size_t stop, PayloadSource source, size_t mark)
+{
+    while (pos != stop)
+    {
+        // an unsent data segment grows up to seg_max_ before a new one starts
+        TCPSegment* last = next_q_.tail_;
+        const size_t room = last && last->len_ > 0 && last->source_ == source ? seg_max_ - last->len_ : 0;
+        size_t len = std::min(room > 0 ? room : seg_max_, stop - pos);
+        if (mark != 0 && !tx_mark_armed_ && mark > pos && mark <= pos + len)
+        {
+            tx_mark_seq_ = next_seq_num_ + (mark - pos - 1);
+            tx_mark_armed_ = true;
+        }
+        if (room > 0)
+        {
+            last->len_ += len;
+            last->brk_len_ = std::min<size_t>(last->len_, ring.contiguous(pos + len - last->len_));
+        }
+        else
+        {
+            engine_.metrics().segment_allocs_.add();
+            TCPSegment* seg = engine_.segmentPool().acquire(
+                ring.at(pos),
+                ring.data(),
+                next_seq_num_,
+                len,
+                std::min(len, ring.contiguous(pos)),
+                TCPFlag::PSH | TCPFlag::ACK
+            );
+            seg->source_ = source;
+            next_q_.push_back(seg);
+        }
+        next_seq_num_ += len;
+        pos += len;
+    }
+}
 
-    if (flags & TCPFlag::PSH) next_seq_num_ += len;
-    else if (flags & TCPFlag::SYN || flags & TCPFlag::FIN) next_seq_num_++;
+bool SendBuffer::mapChunk()
+{
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t wnd = std::min(cwnd_, std::max(rcvwnd_, MSS));
+    const size_t want = std::clamp(2 * wnd, FILE_CHUNK_MIN, FILE_CHUNK_MAX);
+    const size_t len = std::min(want, file_.len_);
+    const off_t base = file_.off_ & ~(off_t)(page - 1);
+    const size_t skip = file_.off_ - base;
+    void* m = mmap(nullptr, skip + len, PROT_READ, MAP_SHARED, file_.fd_, base);
+    if (m == MAP_FAILED)
+    {
+        perror("mmap");
+        // nothing queued after the file can follow a hole in the stream:
+        // fail the connection rather than retry on every pump
+        ::close(file_.fd_);
+        file_.fd_ = -1;
+        if (owner_) owner_->startAbort();
+        return false;
+    }
+    // fault this window in ahead of the sender, and start reading the next
+    madvise(m, skip + len, MADV_WILLNEED);
+    if (file_.len_ > len) posix_fadvise(file_.fd_, file_.off_ + len, std::min(want, file_.len_ - len), POSIX_FADV_WILLNEED);
+    chunks_.push_back({static_cast<std::byte*>(m), skip + len, len});
+    engine_.metrics().file_chunks_.add();
 
-    next_q_.push(p);
+    const std::byte* data = static_cast<std::byte*>(m) + skip;
+    for (size_t done = 0; done < len;)
+    {
+        const size_t n = std::min(seg_max_, len - done);
+        engine_.metrics().segment_allocs_.add();
+        TCPSegment* seg = engine_.segmentPool().acquire(data + done, nullptr, next_seq_num_, n, n, TCPFlag::PSH | TCPFlag::ACK);
+        seg->source_ = PayloadSource::FILE;
+        next_q_.push_back(seg);
+        next_seq_num_ += n;
+        done += n;
+    }
+    file_.off_ += len;
+    file_.len_ -= len;
+    if (file_.len_ == 0)
+    {
+        ::close(file_.fd_);
+        file_.fd_ = -1;
+    }
+    return true;
+}
+
+void SendBuffer::segmentQueued(size_t mark)
+{
+    while (true)
+    {
+        if (file_.fd_ >= 0)
+        {
+            // the next window once this one is on its way
+            if (!next_q_.empty() || !mapChunk() || file_.fd_ >= 0) return;
+            continue;
+        }
+        size_t stop = ring_.tail();
+        const bool file_next = files_queued_.load(std::memory_order_acquire) > 0;
+        if (file_next)
+        {
+            std::lock_guard lock(files_m_);
+            stop = files_.front().ring_pos_;
+        }
+        segmentRing(ring_, seg_pos_, stop, PayloadSource::RING, mark);
+        if (!file_next) break;
+        {
+            std::lock_guard lock(files_m_);
+            file_ = files_.front();
+            files_.pop_front();
+        }
+        files_queued_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    if (splice_src_)
+    {
+        const SPSCByteRing& src = splice_src_->_recv_buffer.ring();
+        segmentRing(src, splice_pos_, src.tail(), PayloadSource::SPLICE, 0);
+    }
+    if (fin_flags_)
+    {
+        engine_.metrics().segment_allocs_.add();
+        next_q_.push_back(engine_.segmentPool().acquire(nullptr, nullptr, next_seq_num_, 0, 0, fin_flags_));
+        next_seq_num_++;
+        fin_flags_ = 0;
+    }
+}
+
+void SendBuffer::pump(const uint8_t ctrl_flags)
+{
+    const size_t mark = tx_mark_pos_.load(std::memory_order_acquire);
+    if (mark != 0 && !tx_mark_armed_ && mark <= seg_pos_)
+    {
+        tx_mark_pos_.store(0, std::memory_order_release); // segmented before we saw it; resample
+    }
+    if (ctrl_flags & TCPFlag::SYN)
+    {
+        // data written before connecting (Fast Open) follows the SYN
+        engine_.metrics().segment_allocs_.add();
+        next_q_.push_back(engine_.segmentPool().acquire(nullptr, nullptr, next_seq_num_, 0, 0, ctrl_flags));
+        next_seq_num_++;
+    }
+    if (ctrl_flags & TCPFlag::FIN) fin_flags_ = ctrl_flags;
+
+    segmentQueued(mark);
     sendSegments();
+}
 
+ssize_t SendBuffer::enqueue(const std::byte* data, size_t len, const uint8_t flags)
+{
+    // TODO: allow options
+    if (ring_.writable() < len) return -1; //FIXME: handle error
+    if (len > 0) write(data, len);
+    pump(flags);
     return len;
 }
 
@@ -144,63 +453,137 @@ void SendBuffer::rttSample(const std::chrono::steady_clock::duration rtt)
 
 void SendBuffer::restartRTO()
 {
-    to_expiry_ = std::chrono::steady_clock::now() + rto_;
+    to_expiry_ = engine_.now() + rto_;
+    if (owner_) engine_.armTimer(owner_, to_expiry_);
+}
+
+bool SendBuffer::ackAcceptable(const uint32_t ack_num) const
+{
+    return SEQ_LEQ(ack_num_, ack_num) && SEQ_LEQ(ack_num, next_seq_num_);
 }
 
 void SendBuffer::handleACK(const uint32_t ack_num, const std::chrono::steady_clock::time_point ack_timestmp)
 {
-    if (ack_num <= ack_num_) return;
+    if (SEQ_LEQ(ack_num, ack_num_))
+    {
+        if (ack_num == ack_num_ && !in_flight_q_.empty()) stat_dup_acks_.add();
+        return;
+    }
     ack_num_ = ack_num;
     //TODO: implement binary search
     bool rtt_probed = false;
-    auto prev_head = head_;
+    bool acked = false;
     size_t bytes_acked = 0;
-    while (!in_flight_q_.empty() && ack_num > in_flight_q_.top()->seq_start_)
+    while (!in_flight_q_.empty() && SEQ_GT(ack_num, in_flight_q_.front()->seq_start_))
     {
-        auto cur = in_flight_q_.top();
+        TCPSegment* cur = in_flight_q_.front();
         if (!rtt_probed && cur->retransmit_cnt_ == 0)
         {
             auto rtt_sample = ack_timestmp - cur->send_tmstp_;
             rttSample(rtt_sample);
             rtt_probed = true;
         }
-        head_ = (head_ + cur->len_) % sz_;
-        auto seq_bytes = (cur->len_ - sizeof(TCPHeader));
-        in_flight_sz_ -= seq_bytes;
-        bytes_acked += seq_bytes;
-        in_flight_q_.pop();
+        acked = true;
+        const uint32_t covered = ack_num - cur->seq_start_;
+        if (covered < cur->len_)
+        {
+            // partly acked super-segment: drop its acked head
+            releasePayload(cur, covered);
+            in_flight_sz_ -= covered;
+            bytes_acked += covered;
+            cur->advance(covered);
+            break;
+        }
+        in_flight_q_.pop_front();
+        releasePayload(cur, cur->len_);
+        in_flight_sz_ -= cur->len_;
+        bytes_acked += cur->len_;
+        engine_.segmentPool().release(cur);
+    }
+    if (syn_data_ && acked)
+    {
+        syn_data_ = false;
+        if (!in_flight_q_.empty())
+        {
+            // the SYN went through without its data: queue it again, to go
+            // out with the window the SYN-ACK brought
+            TCPSegment* data = in_flight_q_.pop_front();
+            in_flight_sz_ -= data->len_;
+            data->retransmit_cnt_++;
+            next_q_.push_front(data);
+            syn_data_rejected_ = true;
+            engine_.metrics().fast_open_fallbacks_.add();
+        }
     }
-    if (!in_flight_q_.empty() && ack_num != in_flight_q_.top()->seq_start_); // TODO: handle out of sync error
-
     updateCwnd(bytes_acked);
+    stat_bytes_acked_.add(bytes_acked);
+    publishGauges();
 
-    if (prev_head != head_)
+    if (acked)
     {
-        restartRTO();
+        // everything written is acked: the block goes back to the pool
+        if (ring_.readable() == 0) ring_.trim();
+        if (!in_flight_q_.empty()) restartRTO();
         sendSegments();
     }
 }
 
-void SendBuffer::handleRTO()
+void SendBuffer::releasePayload(const TCPSegment* seg, size_t n)
 {
-    if (in_flight_q_.empty()) return;
-    auto p = in_flight_q_.top();
-    if ((p->flags_ && TCPFlag::SYN && p->retransmit_cnt_ >= TCP_SYN_RETRIES) ||
-        (p->flags_ && TCPFlag::PSH && p->retransmit_cnt_ >= TCP_RETRIES))
+    switch (seg->source_)
+    {
+        case PayloadSource::RING:
+            ring_.release(n);
+            break;
+        case PayloadSource::FILE:
+        {
+            // segments never span windows, and are acked in order
+            MappedChunk& c = chunks_.front();
+            c.unacked_ -= n;
+            if (c.unacked_ == 0)
+            {
+                munmap(c.map_, c.map_len_);
+                chunks_.pop_front();
+            }
+            break;
+        }
+        case PayloadSource::SPLICE:
+            if (splice_src_) splice_src_->releaseSpliced(n);
+            break;
+    }
+}
+
+bool SendBuffer::handleRTO()
+{
+    if (in_flight_q_.empty()) return false;
+    TCPSegment* p = in_flight_q_.front();
+    if ((p->flags_ & TCPFlag::SYN && p->retransmit_cnt_ >= TCP_SYN_RETRIES) ||
+        (p->flags_ & TCPFlag::PSH && p->retransmit_cnt_ >= TCP_RETRIES))
     {
         // FIXME: handle error
-        in_flight_sz_ -= (p->len_ - sizeof(TCPHeader));
-        in_flight_q_.pop();
-        return;   
+        in_flight_sz_ -= p->len_;
+        releasePayload(p, p->len_);
+        engine_.segmentPool().release(in_flight_q_.pop_front());
+        if (ring_.readable() == 0) ring_.trim();
+        return false;
     }
+    // one MSS at a time, like the wire saw it
+    if (p->len_ > MSS) splitSegment(in_flight_q_, p, MSS);
     p->retransmit_cnt_++;
     rto_ *= 2;
     rto_ = std::clamp(rto_, RTO_MIN, RTO_MAX);
     ssthresh_ = cwnd_ / 2;
     cwnd_ = MSS;
     restartRTO();
-    // send logic
-    engine_.send(p, local_addr_, peer_addr_, recv_buf_);
+    // send logic; a SYN goes again without the data it may have carried
+    if ((p->flags_ & TCPFlag::SYN) && syn_opts_.fast_open_) engine_.send(*p, tmpl_, recv_buf_, syn_opts_);
+    else engine_.send(*p, tmpl_, recv_buf_);
+    stat_retrans_.add();
+    engine_.metrics().retransmits_.add();
+    stat_bytes_retrans_.add(p->len_);
+    stat_bytes_sent_.add(p->len_);
+    publishGauges();
+    return true;
 }
 
 std::chrono::steady_clock::time_point SendBuffer::getRTOExpiry() const
@@ -208,4 +591,75 @@ std::chrono::steady_clock::time_point SendBuffer::getRTOExpiry() const
     return to_expiry_;
 }
 
+bool SendBuffer::rtoArmed() const
+{
+    return !in_flight_q_.empty();
+}
+
+bool SendBuffer::persistArmed() const
+{
+    return persist_armed_ && in_flight_q_.empty() && !next_q_.empty();
+}
+
+std::chrono::steady_clock::time_point SendBuffer::getPersistExpiry() const
+{
+    return persist_expiry_;
+}
+
+bool SendBuffer::handlePersist()
+{
+    if (!persistArmed()) return false;
+    if (rcvwnd_ > 0)
+    {
+        // a window below one MSS that has not grown to half the largest
+        // offered: use it rather than wait for more
+        sendSegments(true);
+        return true;
+    }
+    // an old sequence number: the peer drops it and ACKs with its window
+    TCPSegment probe(nullptr, nullptr, ack_num_ - 1, 0, 0, TCPFlag::ACK);
+    engine_.send(probe, tmpl_, recv_buf_);
+    engine_.metrics().window_probes_.add();
+    persist_backoff_ = std::min<std::chrono::steady_clock::duration>(persist_backoff_ * 2, RTO_MAX);
+    persist_expiry_ = engine_.now() + persist_backoff_;
+    if (owner_) engine_.armTimer(owner_, persist_expiry_);
+    return true;
+}
+
+bool SendBuffer::drained() const
+{
+    return in_flight_q_.empty() && next_q_.empty() && ring_.readable() == 0
+        && file_.fd_ < 0 && files_queued_.load(std::memory_order_acquire) == 0 && !fin_flags_;
+}
+
+void SendBuffer::fillInfo(TCPInfo& info) const
+{
+    info.rtt_us_ = stat_srtt_us_.get();
+    info.rttvar_us_ = stat_rttvar_us_.get();
+    info.rto_us_ = stat_rto_us_.get();
+    info.cwnd_ = stat_cwnd_.get();
+    info.ssthresh_ = stat_ssthresh_.get();
+    info.bytes_in_flight_ = stat_in_flight_.get();
+    info.bytes_sent_ = stat_bytes_sent_.get();
+    info.bytes_retrans_ = stat_bytes_retrans_.get();
+    info.bytes_acked_ = stat_bytes_acked_.get();
+    info.total_retrans_ = stat_retrans_.get();
+    info.dup_acks_ = stat_dup_acks_.get();
+    info.snd_wnd_ = stat_rcvwnd_.get();
+
+    // include the interval we are currently limited in
+    uint64_t rwnd_ns = stat_rwnd_limited_ns_.get();
+    uint64_t cwnd_ns = stat_cwnd_limited_ns_.get();
+    uint64_t limit = stat_limit_.get();
+    if (limit != NOT_LIMITED)
+    {
+        int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(engine_.now().time_since_epoch()).count();
+        int64_t open_ns = std::max<int64_t>(0, now_ns - (int64_t)stat_limit_since_ns_.get());
+        if (limit == RWND_LIMITED) rwnd_ns += open_ns;
+        else cwnd_ns += open_ns;
+    }
+    info.rwnd_limited_us_ = rwnd_ns / 1000;
+    info.cwnd_limited_us_ = cwnd_ns / 1000;
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <Simulator.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+namespace ustacktcp {
+
+ssize_t SimDevice::transmit(const std::byte* pkt, size_t len)
+{
+    if (!peer_) return len; // unconnected link: the wire eats it
+    peer_->inbox_.emplace_back(pkt, pkt + len);
+    return len;
+}
+
+ssize_t SimDevice::receive(std::byte* buf, size_t len, bool)
+{
+    if (inbox_.empty())
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    auto& pkt = inbox_.front();
+    size_t n = std::min(len, pkt.size());
+    memcpy(buf, pkt.data(), n);
+    inbox_.pop_front();
+    return n;
+}
+
+int SimDevice::pollFd() const
+{
+    return -1;
+}
+
+Simulator::Simulator() : clock_(std::make_shared<VirtualClock>()) {}
+
+std::pair<TCPEngine*, TCPEngine*> Simulator::addLink(EngineOptions a, EngineOptions b)
+{
+    auto da = std::make_shared<SimDevice>(), db = std::make_shared<SimDevice>();
+    da->peer_ = db.get();
+    db->peer_ = da.get();
+    devices_.push_back(da);
+    devices_.push_back(db);
+    for (auto* o : {&a, &b})
+    {
+        o->mode_ = EngineMode::RUN_TO_COMPLETION;
+        o->clock_ = clock_;
+    }
+    a.device_ = da;
+    b.device_ = db;
+    engines_.push_back(std::make_unique<TCPEngine>(a));
+    engines_.push_back(std::make_unique<TCPEngine>(b));
+    return {engines_[engines_.size() - 2].get(), engines_.back().get()};
+}
+
+TimePoint Simulator::now() const
+{
+    return clock_->now();
+}
+
+void Simulator::at(TimePoint t, std::function<void()> fn)
+{
+    events_.push({t, order_++, std::move(fn)});
+}
+
+void Simulator::after(std::chrono::nanoseconds d, std::function<void()> fn)
+{
+    at(now() + d, std::move(fn));
+}
+
+size_t Simulator::settle()
+{
+    size_t total = 0, work;
+    do
+    {
+        work = 0;
+        for (auto& e : engines_) work += e->poll();
+        total += work;
+        // a transmit released during a later engine's poll lands in an
+        // earlier engine's inbox
+        for (auto& d : devices_) work += !d->inbox_.empty();
+    } while (work > 0);
+    return total;
+}
+
+bool Simulator::runUntil(TimePoint end, const std::function<bool()>& pred)
+{
+    while (true)
+    {
+        settle();
+        if (pred && pred()) return true;
+        if (settle() > 0) continue; // pred() queued work at the current instant
+
+        TimePoint next = events_.empty() ? TimePoint::max() : events_.top().at_;
+        for (auto& e : engines_) next = std::min(next, e->nextDeadline());
+        if (next == TimePoint::max() || next > end)
+        {
+            if (end != TimePoint::max()) clock_->advanceTo(end);
+            return false;
+        }
+        // a deadline that is already due but produced no work must not stall us
+        clock_->advanceTo(std::max(next, now() + std::chrono::nanoseconds(1)));
+        steps_++;
+
+        while (!events_.empty() && events_.top().at_ <= now())
+        {
+            auto fn = std::move(const_cast<Event&>(events_.top()).fn_);
+            events_.pop();
+            fn();
+        }
+    }
+}
+
+bool Simulator::runFor(std::chrono::nanoseconds d, const std::function<bool()>& pred)
+{
+    return runUntil(now() + d, pred);
+}
+
+uint64_t Simulator::steps() const
+{
+    return steps_;
+}
+
+}
@@ -1,162 +1,226 @@
 #include <StreamSocket.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 #include <arpa/inet.h>
 
+#include <TCPStateTable.hpp>
+
 namespace ustacktcp {
 
-void StreamSocket::setTimeWaitExipiry()
+TimePoint StreamSocket::nextTimer() const
+{
+    if (_state == SocketState::CLOSED) return TimePoint::max();
+    TimePoint at = TimePoint::max();
+    if (_send_buffer.rtoArmed()) at = _send_buffer.getRTOExpiry();
+    if (_send_buffer.persistArmed()) at = std::min(at, _send_buffer.getPersistExpiry());
+    return at;
+}
+
+void StreamSocket::setState(SocketState s)
+{
+    bool closing = s == SocketState::CLOSED && _state != SocketState::CLOSED;
+    _state.store(s, std::memory_order_release);
+    if (closing)
+    {
+        closed_ = true;
+        // after the store: tearing down the relay may come back to us
+        if (splice_dst_ || splice_src_) unsplice();
+    }
+    if (_engine.loopMode()) signal();
+    else wait_->cv_.notify_all();
+}
+
+void StreamSocket::signal()
+{
+    events_.fetch_add(1, std::memory_order_release);
+    events_.notify_all();
+}
+
+uint32_t StreamSocket::awaitEvent(uint32_t seen)
+{
+    events_.wait(seen, std::memory_order_acquire);
+    return events_.load(std::memory_order_acquire);
+}
+
+void StreamSocket::notifyReadable()
 {
-    time_wait_expiry_ = std::chrono::steady_clock::now() + time_wait_to_;
+    if (splice_dst_)
+    {
+        forwardSpliced();
+        return;
+    }
+    if (!_engine.loopMode())
+    {
+        wait_->cv_.notify_all();
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (rx_waiting_.load(std::memory_order_relaxed) && rx_waiting_.exchange(false)) signal();
 }
 
-void StreamSocket::timeWaitTO()
+void StreamSocket::notifyWritable()
 {
-    _state = SocketState::CLOSED;
-    cv_.notify_all();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (tx_waiting_.load(std::memory_order_relaxed) && _send_buffer.writable() >= tx_lowat_ && tx_waiting_.exchange(false)) signal();
+}
+
+void StreamSocket::ringDoorbell()
+{
+    if (!tx_armed_.exchange(true, std::memory_order_acq_rel))
+    {
+        _engine.post({RequestType::SEND, shared_from_this(), {}});
+    }
+}
+
+bool StreamSocket::startSplice(const std::shared_ptr<StreamSocket>& dst)
+{
+    splice_ok_ = false;
+    auto open = [](SocketState s) { return s != SocketState::CLOSED && s != SocketState::LISTEN; };
+    if (splice_dst_ || dst->splice_src_ || !open(_state) || !open(dst->_state)) return false;
+    splice_dst_ = dst;
+    dst->splice_src_ = shared_from_this();
+    // unread bytes first
+    dst->_send_buffer.setSpliceSource(this, _recv_buffer.ring().head());
+    forwardSpliced();
+    splice_ok_ = true;
+    return true;
+}
+
+void StreamSocket::forwardSpliced()
+{
+    splice_dst_->_send_buffer.pump();
+    if (!splice_fin_ && _recv_buffer.finReceived())
+    {
+        // after the data: pump() has segmented all of it
+        splice_fin_ = true;
+        splice_dst_->startClose();
+    }
+}
+
+void StreamSocket::releaseSpliced(size_t len)
+{
+    _recv_buffer.release(len);
+    sendWindowUpdate();
+}
+
+void StreamSocket::unsplice()
+{
+    if (splice_src_)
+    {
+        // we send no more, and what we sent needs its ring no longer
+        _send_buffer.setSpliceSource(nullptr, 0);
+        std::shared_ptr<StreamSocket> src = std::move(splice_src_);
+        bool relaying = src->splice_dst_.get() == this;
+        if (relaying) src->splice_dst_.reset();
+        size_t left = src->_recv_buffer.ring().readable();
+        if (left > 0) src->_recv_buffer.release(left);
+        // src acked bytes to its peer that will never be delivered
+        if (relaying && (left > 0 || !src->splice_fin_)) src->startAbort();
+    }
+    if (splice_dst_)
+    {
+        // an abort: the relay ends here too
+        if (!splice_fin_) splice_dst_->startClose();
+        splice_dst_.reset();
+    }
 }
 
 bool StreamSocket::validSeqNum(uint32_t seq_start, size_t len) const
 {
-    uint32_t seq_end = seq_start + len - 1;
-    uint32_t rcv_start = _recv_buffer.getAckNumber(), rcv_end = rcv_start + _recv_buffer.getWindowSize() -1;
-    return (SEQ_LEQ(rcv_start,seq_start) && SEQ_LEQ(seq_start,rcv_end)) || (SEQ_LEQ(rcv_start,seq_end) && SEQ_LEQ(seq_end,rcv_end));
-}
-
-bool StreamSocket::validFlags(uint8_t flags) const
-{
-    if (flags == 0) return false;
-    SocketState s;
-    s = _state;
-    // Extract only control bits
-    uint8_t f = flags & (TCPFlag::SYN | TCPFlag::ACK | TCPFlag::FIN | TCPFlag::RST);
-
-    switch (s)
-    {
-        case SocketState::LISTEN:
-            return f == TCPFlag::SYN;
-
-        case SocketState::SYN_SENT:
-            // Valid:
-            // SYN        (simultaneous open)
-            // SYN|ACK    (normal handshake)
-            // ACK        (acceptable if ACKs something valid)
-            // RST        (abort from peer)
-            return
-                f == TCPFlag::SYN ||
-                f == (TCPFlag::SYN | TCPFlag::ACK) ||
-                // TODO: should this be allowed? f == TCPFlag::ACK || 
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::SYN_RECEIVED:
-            // Valid:
-            // ACK        (handshake completion)
-            // FIN        (rare but legal)
-            // RST        (abort)
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == TCPFlag::FIN ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::ESTABLISHED:
-            // Valid:
-            // ACK
-            // FIN|ACK
-            // RST
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == (TCPFlag::FIN | TCPFlag::ACK) ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::FIN_WAIT_1:
-            // Valid:
-            // ACK
-            // FIN|ACK
-            // FIN        (remote closing early before ACKing our FIN)
-            // RST
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == (TCPFlag::FIN | TCPFlag::ACK) ||
-                f == TCPFlag::FIN ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::FIN_WAIT_2:
-            // Valid:
-            // ACK
-            // FIN|ACK
-            // RST
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == (TCPFlag::FIN | TCPFlag::ACK) ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::CLOSE_WAIT:
-            // Valid:
-            // ACK
-            // RST
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::CLOSING:
-            // Valid:
-            // ACK
-            // RST
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::LAST_ACK:
-            // Valid:
-            // ACK
-            // RST
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        case SocketState::TIME_WAIT:
-            // Valid:
-            // ACK
-            // FIN|ACK   (duplicate FINs)
-            // RST
-            // RST|ACK
-            return
-                f == TCPFlag::ACK ||
-                f == (TCPFlag::FIN | TCPFlag::ACK) ||
-                f == TCPFlag::RST ||
-                f == (TCPFlag::RST | TCPFlag::ACK);
-
-        default:
-            return false;
+    // overlaps [rcv_nxt, rcv_nxt + wnd]; the right edge is included so a
+    // segment at rcv_nxt still has its ACK and window processed while our
+    // window is closed (as Linux tcp_sequence() does)
+    uint32_t rcv_start = _recv_buffer.getAckNumber(), rcv_end = rcv_start + _recv_buffer.getWindowSize();
+    return SEQ_GEQ(seq_start + len, rcv_start) && SEQ_LEQ(seq_start, rcv_end);
+}
+
+bool StreamSocket::ackRejected(const TCPHeader& tcphdr, size_t data_len)
+{
+    SocketState s = _state;
+    if ((tcphdr.flags & TCPFlag::RST) || s == SocketState::LISTEN || s == SocketState::SYN_SENT || s == SocketState::CLOSED) return false;
+    if (data_len == 0 && !(tcphdr.flags & (TCPFlag::SYN | TCPFlag::FIN)))
+    {
+        TimePoint now = _engine.now();
+        if (now - oow_ack_at_ < OOW_ACK_INTERVAL) return false;
+        oow_ack_at_ = now;
+    }
+    return true;
+}
+
+void StreamSocket::checkWindow()
+{
+    if (!_recv_buffer.windowUpdateDue()) return;
+    if (!_engine.loopMode())
+    {
+        sendWindowUpdate();
+        return;
+    }
+    if (!wnd_armed_.exchange(true, std::memory_order_acq_rel))
+    {
+        _engine.post({RequestType::WINDOW, shared_from_this(), {}});
     }
 }
 
+void StreamSocket::sendWindowUpdate()
+{
+    // only while the peer may still send, and unless an ACK since did it
+    SocketState s = _state;
+    if (s != SocketState::ESTABLISHED && s != SocketState::FIN_WAIT_1 && s != SocketState::FIN_WAIT_2) return;
+    if (!_recv_buffer.windowUpdateDue()) return;
+    TCPSegment ack(nullptr, nullptr, _send_buffer.getSeqNumber(), 0, 0, TCPFlag::ACK);
+    _engine.send(ack, _send_buffer.headerTemplate(), _recv_buffer);
+    _engine.metrics().window_updates_.add();
+}
+
 // FIXME: delete this constructor and use factory method
-StreamSocket::StreamSocket(TCPEngine& engine) : _engine(engine), _send_buffer(engine, _recv_buffer), time_wait_expiry_(std::chrono::steady_clock::now()) {}
+StreamSocket::StreamSocket(TCPEngine& engine) : _engine(engine), _recv_buffer(&engine.bufferPool()), _send_buffer(engine, _recv_buffer, this)
+{
+    if (!engine.loopMode()) wait_ = std::make_unique<Waiter>();
+}
 
 
 bool StreamSocket::bind(const SocketAddr& addr)
 {
     _local_addr = addr;
     _send_buffer.setLocalAddr(addr);
+    if (_engine.loopMode() && _engine.running())
+    {
+        // the loop thread owns the bound table and timer list
+        uint32_t e = events_.load(std::memory_order_acquire);
+        _engine.post({RequestType::BIND, shared_from_this(), addr});
+        awaitEvent(e); // request handled
+        return bind_ok_;
+    }
     return _engine.bind(addr, shared_from_this());
 }
 
+bool StreamSocket::startConnect(const SocketAddr& addr)
+{
+    // the tuple may still be in TIME_WAIT from an earlier connection
+    if (!_engine.claimTuple(*this, addr)) return false;
+    _peer_addr = addr;
+    _send_buffer.setPeerAddr(addr);
+    if (fast_open_)
+    {
+        // no cookie yet: an empty option asks for one
+        TCPOptions opts;
+        opts.fast_open_ = true;
+        _engine.fastOpen().lookup(addr.ip.addr, opts);
+        _send_buffer.setSynOptions(opts);
+    }
+    setState(SocketState::SYN_SENT);
+    _send_buffer.enqueue(nullptr, 0, TCPFlag::SYN);
+    return true;
+}
+
+ssize_t StreamSocket::queueFastOpen(const std::byte* buf, size_t len)
+{
+    fast_open_ = true;
+    return _send_buffer.write(buf, len);
+}
+
 bool StreamSocket::connect(const SocketAddr& addr)
 {
     // Send SYN
@@ -164,31 +228,68 @@ bool StreamSocket::connect(const SocketAddr& addr)
     // Wait for SYN or SYN-ACK
     // SYN -> SYN_RECEIVED
     // SYN-ACK -> ESTABLISHED
-    std::unique_lock<std::mutex> lock(m_);
+    if (_engine.loopMode())
+    {
+        if (_state != SocketState::CLOSED) return false; // TODO: handle error
+        uint32_t e = events_.load(std::memory_order_acquire);
+        _engine.post({RequestType::CONNECT, shared_from_this(), addr});
+        e = awaitEvent(e); // request handled
+        while (_state != SocketState::CLOSED && _state != SocketState::ESTABLISHED) e = awaitEvent(e);
+        return _state == SocketState::ESTABLISHED;
+    }
+    std::unique_lock<std::mutex> lock(wait_->m_);
     if (_state != SocketState::CLOSED) return false; // TODO: handle error
-    _peer_addr = addr;
-    _send_buffer.setPeerAddr(addr);
-    _state = SocketState::SYN_SENT;
-    _send_buffer.enqueue(nullptr, 0, TCPFlag::SYN);
-    cv_.wait(lock, [this]() {
+    startConnect(addr);
+    wait_->cv_.wait(lock, [this]() {
         return _state == SocketState::CLOSED || _state == SocketState::ESTABLISHED;
     });
 
     return _state == SocketState::ESTABLISHED;
 }
 
+ssize_t StreamSocket::connectFastOpen(const SocketAddr& addr, const std::byte* buf, size_t len)
+{
+    if (_engine.loopMode())
+    {
+        if (_state != SocketState::CLOSED) return -1;
+        uint32_t e = events_.load(std::memory_order_acquire);
+        ssize_t n = queueFastOpen(buf, len);
+        _engine.post({RequestType::CONNECT, shared_from_this(), addr});
+        e = awaitEvent(e); // request handled
+        while (_state != SocketState::CLOSED && _state != SocketState::ESTABLISHED) e = awaitEvent(e);
+        return _state == SocketState::ESTABLISHED ? n : -1;
+    }
+    std::unique_lock<std::mutex> lock(wait_->m_);
+    if (_state != SocketState::CLOSED) return -1;
+    ssize_t n = queueFastOpen(buf, len);
+    startConnect(addr);
+    wait_->cv_.wait(lock, [this]() {
+        return _state == SocketState::CLOSED || _state == SocketState::ESTABLISHED;
+    });
+    return _state == SocketState::ESTABLISHED ? n : -1;
+}
+
 bool StreamSocket::listen()
 {
-    std::unique_lock<std::mutex> lock(m_);
+    if (_engine.loopMode())
+    {
+        if (_state != SocketState::CLOSED) return false; // TODO: handle error
+        uint32_t e = events_.load(std::memory_order_acquire);
+        _engine.post({RequestType::LISTEN, shared_from_this(), {}});
+        e = awaitEvent(e); // request handled
+        while (_state != SocketState::CLOSED && _state != SocketState::ESTABLISHED) e = awaitEvent(e);
+        return _state == SocketState::ESTABLISHED;
+    }
+    std::unique_lock<std::mutex> lock(wait_->m_);
     if (_state != SocketState::CLOSED) return false; // TODO: handle error
     _state = SocketState::LISTEN;
-    cv_.wait(lock, [this]() {
+    wait_->cv_.wait(lock, [this]() {
         return _state == SocketState::CLOSED || _state == SocketState::ESTABLISHED;
     });
     return _state == SocketState::ESTABLISHED;
 }
 
-bool StreamSocket::close()
+bool StreamSocket::startClose()
 {
     if (_state != SocketState::LISTEN && _state != SocketState::SYN_SENT && _state != SocketState::SYN_RECEIVED && _state != SocketState::ESTABLISHED && _state != SocketState::CLOSE_WAIT)
     {
@@ -196,28 +297,89 @@ bool StreamSocket::close()
     }
     if (_state == SocketState::LISTEN || _state == SocketState::SYN_SENT)
     {
-        _state = SocketState::CLOSED;
+        setState(SocketState::CLOSED);
         return true;
     }
     if (_state == SocketState::CLOSE_WAIT)
     {
-        _state = SocketState::LAST_ACK;
+        setState(SocketState::LAST_ACK);
     }
     else
     {
-        _state = SocketState::FIN_WAIT_1;
+        setState(SocketState::FIN_WAIT_1);
     }
     _send_buffer.enqueue(nullptr, 0, TCPFlag::FIN | TCPFlag::ACK);
     return true;
 }
 
+bool StreamSocket::startAbort()
+{
+    SocketState s = _state;
+    if (s == SocketState::CLOSED) return false;
+    // nobody has heard of us yet from LISTEN or SYN_SENT
+    if (s != SocketState::LISTEN && s != SocketState::SYN_SENT)
+    {
+        TCPSegment rst(nullptr, nullptr, _send_buffer.getSeqNumber(), 0, 0, TCPFlag::RST | TCPFlag::ACK);
+        _engine.send(rst, _send_buffer.headerTemplate(), _recv_buffer);
+    }
+    setState(SocketState::CLOSED);
+    return true;
+}
+
+bool StreamSocket::close()
+{
+    if (!_engine.loopMode()) return startClose();
+
+    SocketState s = _state;
+    if (s != SocketState::LISTEN && s != SocketState::SYN_SENT && s != SocketState::SYN_RECEIVED && s != SocketState::ESTABLISHED && s != SocketState::CLOSE_WAIT)
+    {
+        return false; // TODO: handle error
+    }
+    _engine.post({RequestType::CLOSE, shared_from_this(), {}});
+    return true;
+}
+
+bool StreamSocket::abort()
+{
+    if (!_engine.loopMode()) return startAbort();
+    if (_state == SocketState::CLOSED) return false;
+    _engine.post({RequestType::ABORT, shared_from_this(), {}});
+    return true;
+}
+
+
+ssize_t StreamSocket::sendRing(const std::byte* buf, size_t len)
+{
+    size_t sent = 0;
+    while (true)
+    {
+        uint32_t e = events_.load(std::memory_order_acquire);
+        size_t n = _send_buffer.write(buf + sent, len - sent);
+        sent += n;
+        if (n > 0) ringDoorbell();
+        if (sent == len) return sent;
+        if (_state == SocketState::CLOSED) return sent > 0 ? sent : -1;
+
+        // ring full: sleep until the engine frees tx_lowat_ bytes
+        size_t want = std::min(tx_lowat_, len - sent);
+        tx_waiting_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_send_buffer.writable() >= want || _state == SocketState::CLOSED)
+        {
+            tx_waiting_.store(false);
+            continue;
+        }
+        awaitEvent(e);
+    }
+}
 
 ssize_t StreamSocket::send(const std::byte* buf, size_t len)
 {
+    if (_engine.loopMode()) return sendRing(buf, len);
     // Enqueue data into send buffer
     ssize_t enq_bytes;
     {
-        std::lock_guard lock(m_);
+        std::lock_guard lock(wait_->m_);
         enq_bytes = _send_buffer.enqueue(buf, len, TCPFlag::PSH | TCPFlag::ACK);
     }
     if (enq_bytes < 0)
@@ -227,140 +389,285 @@ ssize_t StreamSocket::send(const std::byte* buf, size_t len)
     return enq_bytes;
 }
 
+void StreamSocket::handleRequest(SocketRequest& req)
+{
+    switch (req.type_)
+    {
+        case RequestType::BIND:
+            bind_ok_ = _engine.bind(req.addr_, shared_from_this());
+            break;
+        case RequestType::CONNECT:
+            if (_state == SocketState::CLOSED) startConnect(req.addr_);
+            break;
+        case RequestType::LISTEN:
+            if (_state == SocketState::CLOSED) setState(SocketState::LISTEN);
+            break;
+        case RequestType::SEND:
+            tx_armed_.store(false, std::memory_order_release);
+            _send_buffer.pump();
+            return; // the doorbell is not waited on
+        case RequestType::WINDOW:
+            wnd_armed_.store(false, std::memory_order_release);
+            sendWindowUpdate();
+            return;
+        case RequestType::CLOSE:
+            startClose();
+            break;
+        case RequestType::ABORT:
+            startAbort();
+            break;
+        case RequestType::SPLICE:
+            startSplice(req.peer_);
+            break;
+    }
+    signal();
+}
+
+bool StreamSocket::fastPath(const TCPHeader& tcphdr, const std::byte* payload, const size_t data_len)
+{
+    if (_state != SocketState::ESTABLISHED) return false;
+    if ((tcphdr.flags & ~TCPFlag::PSH) != TCPFlag::ACK) return false;
+    if (!_recv_buffer.inSequence(tcphdr.seq_num, data_len)) return false;
+    if (!_send_buffer.ackAcceptable(tcphdr.ack_num)) return false;
+
+    // the window first: handleACK() sends, and must not do so against the
+    // old window slid forward by the new ACK
+    _send_buffer.windowUpdate(tcphdr.window_size, tcphdr.seq_num, tcphdr.ack_num);
+    _send_buffer.handleACK(tcphdr.ack_num, _engine.now());
+    if (_engine.loopMode()) notifyWritable();
+    if (data_len > 0)
+    {
+        _recv_buffer.append(payload, data_len);
+        notifyReadable();
+    }
+    return true;
+}
+
 std::optional<uint8_t> StreamSocket::handleCntrl(const TCPHeader& tcphdr, const SocketAddr& src_addr, const size_t data_len)
 {
-    bool flags_ok = validFlags(tcphdr.flags);
-    bool seq_ok = ((_state == SocketState::LISTEN || _state == SocketState::SYN_SENT || _state == SocketState::SYN_RECEIVED) && flags_ok) || validSeqNum(tcphdr.seq_num, data_len);
-    if (!seq_ok) return std::nullopt; //TODO: handle error
-    if (!flags_ok || (tcphdr.flags & TCPFlag::RST))
+    const SocketState s = _state;
+    const Transition& t = transition(s, tcphdr.flags);
+    if (t.check_seq_ && !validSeqNum(tcphdr.seq_num, data_len)) return std::nullopt;
+    if (t.actions_ & ACT_ABORT)
     {
-        {
-            std::lock_guard lock(m_);
-            _state = SocketState::CLOSED;
-        }
+        setState(SocketState::CLOSED);
         // TODO: send RST
         // TODO: set error and wake blocked threads
-        return TCPFlag::RST; 
+        return TCPFlag::RST;
     }
 
-    SocketState s;
+    if (t.actions_ & ACT_ACK)
     {
-        std::lock_guard lock(m_);
-        s = _state;
+        _send_buffer.windowUpdate(tcphdr.window_size, tcphdr.seq_num, tcphdr.ack_num);
+        _send_buffer.handleACK(tcphdr.ack_num, _engine.now());
+        if (_engine.loopMode()) notifyWritable();
     }
-
-    if (s != SocketState::LISTEN && s != SocketState::SYN_SENT && s != SocketState::SYN_RECEIVED)
+    else
+    {
+        _send_buffer.setRcvWnd(tcphdr.window_size);
+    }
+    if (t.actions_ & ACT_PEER)
     {
-        // handle ack
-        _send_buffer.handleACK(tcphdr.ack_num, std::chrono::steady_clock::now());
+        _peer_addr = src_addr;
+        _send_buffer.setPeerAddr(src_addr);
     }
+    if (t.actions_ & ACT_IRS) _recv_buffer.setIRS(tcphdr.seq_num);
+    if (t.actions_ & ACT_ACK_SYN) _send_buffer.handleACK(tcphdr.ack_num, _engine.now());
 
-    _send_buffer.setRcvWnd(tcphdr.window_size);
+    uint8_t res_flags = t.reply_;
+    if ((t.actions_ & ACT_ACK_DATA) && data_len > 0) res_flags |= TCPFlag::ACK;
 
-    uint8_t res_flags = 0;
+    SocketState next = t.next_;
+    if (t.next_drained_ != next && _send_buffer.drained()) next = t.next_drained_;
+    if (next != s) setState(next);
+    return res_flags;
+}
 
-    switch (s)
+size_t StreamSocket::handleSynOptions(SocketState from, const TCPOptions& opts, const size_t data_len)
+{
+    FastOpen& fo = _engine.fastOpen();
+    const uint32_t peer = _peer_addr.ip.addr;
+    if (from == SocketState::LISTEN && _state == SocketState::SYN_RECEIVED)
     {
-        case SocketState::LISTEN:
-            res_flags = (TCPFlag::SYN | TCPFlag::ACK);
-            _peer_addr = src_addr;
-            _send_buffer.setPeerAddr(src_addr);
-            _recv_buffer.setIRS(tcphdr.seq_num);
-            _state = SocketState::SYN_RECEIVED;
-            break;
-        case SocketState::SYN_SENT:
-            _recv_buffer.setIRS(tcphdr.seq_num);
-            if (tcphdr.flags == TCPFlag::SYN)
-            {
-                res_flags = (TCPFlag::SYN | TCPFlag::ACK);
-                _state = SocketState::SYN_RECEIVED;
-            }
-            else //SYN|ACK
-            {
-                res_flags = TCPFlag::ACK;
-                _send_buffer.handleACK(tcphdr.ack_num, std::chrono::steady_clock::now());
-                _state = SocketState::ESTABLISHED;
-                cv_.notify_all();
-            }
-            break;
-        case SocketState::SYN_RECEIVED:
-            if (tcphdr.flags == TCPFlag::ACK)
-            {
-                _send_buffer.handleACK(tcphdr.ack_num, std::chrono::steady_clock::now());
-                _state = SocketState::ESTABLISHED;
-                cv_.notify_all();
-            }
-            else //FIN
-            {
-                _state = SocketState::LISTEN;
-            }
-            break;
-        case SocketState::ESTABLISHED:
-            if (tcphdr.flags == (TCPFlag::FIN | TCPFlag::ACK))
-            {
-                res_flags = TCPFlag::ACK;
-                _state = SocketState::CLOSE_WAIT;
-                break;
-            }
-            // handle normal ack
-            if (data_len > 0) res_flags = TCPFlag::ACK;
-            break;
-        case SocketState::FIN_WAIT_1:
-            if (tcphdr.flags == TCPFlag::ACK)
-            {
-                _state = SocketState::FIN_WAIT_2;
-            }
-            else if (tcphdr.flags == (TCPFlag::FIN | TCPFlag::ACK))
-            {
-                res_flags = TCPFlag::ACK;
-                setTimeWaitExipiry();
-                _state = TIME_WAIT;
-            }
-            else //FIN
-            {
-                res_flags = TCPFlag::ACK;
-                _state = SocketState::CLOSING;
-            }
-            break;
-        case SocketState::FIN_WAIT_2:
-            if (tcphdr.flags == TCPFlag::ACK)
-            {
+        // data on a SYN is only taken from a client that proved, with a
+        // cookie, that it got our SYN-ACK at this address before
+        if (!_engine.fastOpenServer() || !opts.fast_open_) return 0;
+        if (fo.valid(opts, peer, _local_addr.ip.addr))
+        {
+            if (data_len > 0) _engine.metrics().fast_open_accepted_.add();
+            return data_len;
+        }
+        TCPOptions reply;
+        fo.cookie(reply, peer, _local_addr.ip.addr);
+        _send_buffer.setSynOptions(reply);
+        _engine.metrics().fast_open_cookies_.add();
+        return 0;
+    }
+    if (from == SocketState::SYN_SENT && fast_open_)
+    {
+        // a fresh cookie replaces ours; a server that took no data and
+        // offers none has turned Fast Open off
+        if (opts.cookie_len_ > 0) fo.store(peer, opts);
+        else if (_send_buffer.synDataRejected()) fo.forget(peer);
+    }
+    return data_len;
+}
 
-            }
-            else //FIN|ACK
-            {
-                res_flags = TCPFlag::ACK;
-                setTimeWaitExipiry();
-                _state = SocketState::TIME_WAIT;
-            }
-            break;
-        case SocketState::CLOSE_WAIT:
-            break;
-        case SocketState::CLOSING:
-            setTimeWaitExipiry();
-            _state = SocketState::TIME_WAIT;
-            break;
-        case SocketState::LAST_ACK:
-            _state = SocketState::CLOSED;
-            cv_.notify_all();
-            break;
-        case SocketState::TIME_WAIT:
-            break;
-        default:
-            break;
+ssize_t StreamSocket::recvRing(std::byte* buf, size_t len)
+{
+    while (true)
+    {
+        uint32_t e = events_.load(std::memory_order_acquire);
+        ssize_t n = _recv_buffer.dequeue(buf, len);
+        if (n > 0)
+        {
+            sampleRecvLatency();
+            checkWindow();
+            return n;
+        }
+        if (_state == SocketState::CLOSED) return -1;
+
+        if (spinForData()) continue;
+
+        rx_waiting_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_recv_buffer.availableData() || _state == SocketState::CLOSED)
+        {
+            rx_waiting_.store(false);
+            continue;
+        }
+        awaitEvent(e);
     }
+}
 
-    return res_flags;
+void StreamSocket::setBusyPoll(std::chrono::microseconds budget)
+{
+    busy_poll_max_ = budget;
+    busy_poll_budget_ = budget;
+    if (budget.count() > 0) _engine.requestBusyPoll(budget);
+}
+
+BusyPollStats StreamSocket::getBusyPollStats() const
+{
+    return {spin_hits_.get(), spin_sleeps_.get()};
+}
+
+TCPInfo StreamSocket::getInfo() const
+{
+    TCPInfo info{};
+    info.state_ = _state;
+    _send_buffer.fillInfo(info);
+    _recv_buffer.fillInfo(info);
+    return info;
+}
+
+bool StreamSocket::spinForData()
+{
+    if (busy_poll_max_.count() == 0) return false;
+    const auto floor = busy_poll_max_ / 16;
+    const auto deadline = std::chrono::steady_clock::now() + busy_poll_budget_;
+    do
+    {
+        for (int i = 0; i < 64; ++i)
+        {
+            if (_recv_buffer.availableData() || _state == SocketState::CLOSED)
+            {
+                spin_hits_.add();
+                busy_poll_budget_ = std::min(busy_poll_max_, busy_poll_budget_ * 2);
+                return true;
+            }
+            cpuRelax();
+        }
+    } while (std::chrono::steady_clock::now() < deadline);
+    spin_sleeps_.add();
+    busy_poll_budget_ = std::max(floor, busy_poll_budget_ / 2);
+    return false;
 }
 
 ssize_t StreamSocket::recv(std::byte* buf, size_t len)
 {
-    std::unique_lock<std::mutex> lock(m_);
-    cv_.wait(lock, [this]() {
+    if (_engine.loopMode()) return recvRing(buf, len);
+    if (!_recv_buffer.availableData() && _state != SocketState::CLOSED) spinForData();
+    std::unique_lock<std::mutex> lock(wait_->m_);
+    wait_->cv_.wait(lock, [this]() {
         return _recv_buffer.availableData() || _state == SocketState::CLOSED;
     });
     if (_state == SocketState::CLOSED) return -1;
-    return _recv_buffer.dequeue(buf, len);
+    ssize_t n = _recv_buffer.dequeue(buf, len);
+    sampleRecvLatency();
+    checkWindow();
+    return n;
+}
+
+ssize_t StreamSocket::tryRecv(std::byte* buf, size_t len)
+{
+    ssize_t n = _recv_buffer.dequeue(buf, len);
+    if (n > 0)
+    {
+        sampleRecvLatency();
+        if (_engine.loopMode())
+        {
+            checkWindow();
+        }
+        else
+        {
+            std::lock_guard lock(wait_->m_);
+            checkWindow();
+        }
+        return n;
+    }
+    return _state == SocketState::CLOSED ? -1 : 0;
+}
+
+bool StreamSocket::connectAsync(const SocketAddr& addr)
+{
+    if (!_engine.loopMode() || _state != SocketState::CLOSED) return false;
+    _engine.post({RequestType::CONNECT, shared_from_this(), addr});
+    return true;
+}
+
+ssize_t StreamSocket::connectFastOpenAsync(const SocketAddr& addr, const std::byte* buf, size_t len)
+{
+    if (!_engine.loopMode() || _state != SocketState::CLOSED) return -1;
+    ssize_t n = queueFastOpen(buf, len);
+    _engine.post({RequestType::CONNECT, shared_from_this(), addr});
+    return n;
+}
+
+bool StreamSocket::listenAsync()
+{
+    if (!_engine.loopMode() || _state != SocketState::CLOSED) return false;
+    _engine.post({RequestType::LISTEN, shared_from_this(), {}});
+    return true;
+}
+
+ssize_t StreamSocket::trySend(const std::byte* buf, size_t len)
+{
+    if (!_engine.loopMode()) return -1;
+    if (_state == SocketState::CLOSED) return -1;
+    size_t n = _send_buffer.write(buf, len);
+    if (n > 0) ringDoorbell();
+    return n;
+}
+
+ssize_t StreamSocket::sendFile(int fd, off_t offset, size_t len)
+{
+    if (_engine.loopMode())
+    {
+        if (_state == SocketState::CLOSED) return -1;
+        ssize_t n = _send_buffer.writeFile(fd, offset, len);
+        if (n > 0) ringDoorbell();
+        return n;
+    }
+    std::lock_guard lock(wait_->m_);
+    ssize_t n = _send_buffer.writeFile(fd, offset, len);
+    if (n > 0) _send_buffer.pump();
+    return n;
+}
+
+void StreamSocket::sampleRecvLatency()
+{
+    if (auto lat = _recv_buffer.takeLatencySample()) _engine.metrics().wire_to_recv_ns_.record(*lat);
 }
 
 
@@ -10,6 +10,9 @@
 #include <netpacket/packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <cerrno>
 
 #include <TCPEngine.hpp>
 #include <RecvBuffer.hpp>
@@ -19,143 +22,677 @@ namespace ustacktcp {
 
 std::shared_ptr<StreamSocket> make_socket(TCPEngine& engine)
 {
-    const auto ptr = std::make_shared<StreamSocket>(engine);
-    engine.sockets_.push_back(ptr);
-    return ptr;
+    // the engine only takes a reference once the socket is bound
+    return std::make_shared<StreamSocket>(engine);
+}
+
+bool splice(const std::shared_ptr<StreamSocket>& src, const std::shared_ptr<StreamSocket>& dst)
+{
+    TCPEngine& engine = src->_engine;
+    if (src == dst || &dst->_engine != &engine || !engine.loopMode()) return false;
+    if (!engine.running()) return src->startSplice(dst);
+    // the loop thread owns both connections' buffers
+    uint32_t e = src->events_.load(std::memory_order_acquire);
+    engine.post({RequestType::SPLICE, src, {}, dst});
+    src->awaitEvent(e);
+    return src->splice_ok_;
 }
     
-TCPEngine::TCPEngine()
+TCPEngine::TCPEngine(const EngineOptions& opts) : buf_pool_(SOCKET_BUFFER_SIZE, opts.buffer_cache_), seg_pool_(opts.segment_pool_reserve_), tw_(opts.time_wait_), timer_(metrics_.timer_fires_), opts_(opts), fast_open_(opts.fast_open_key_)
 {
-    _raw_fd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
-    if (_raw_fd < 0)
+    // app, receive and timer threads all create and retire segments
+    seg_pool_.setShared(!loopMode());
+    timer_.setShared(!loopMode());
+    dev_ = opts_.device_ ? opts_.device_ : std::make_shared<RawSocketDevice>();
+    if (opts_.link_emulator_)
+    {
+        link_ = std::make_shared<LinkEmulator>(dev_, *opts_.link_emulator_, opts_.clock_);
+        dev_ = link_;
+    }
+    // nothing is bound yet: the first filter drops everything
+    filter_ = opts_.rx_filter_ && dev_->setFilter(filter_set_);
+    tso_max_ = dev_->maxSegment();
+    if (opts_.busy_poll_.count() > 0) requestBusyPoll(opts_.busy_poll_);
+    if (!opts_.metrics_export_.path_.empty())
+    {
+        exporter_ = std::make_unique<MetricsExporter>(metrics_, opts_.metrics_export_);
+        exporter_->start();
+    }
+    if (loopMode())
     {
-        perror("TCPEngine::socket");
-        exit(1);
+        // timers are expired by the loop thread in poll()
+        wake_fd_ = eventfd(0, EFD_NONBLOCK);
+        if (wake_fd_ < 0)
+        {
+            perror("TCPEngine::eventfd");
+            exit(1);
+        }
+        return;
     }
-    std::thread t(&TimerManager::timeoutLoop, &timer_);
+    std::thread t(&TCPEngine::timerLoop, this);
     t.detach();
 }
 
+void TCPEngine::timerLoop()
+{
+    while (true)
+    {
+        expireTimers(now());
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+size_t TCPEngine::expireTimers(TimePoint now)
+{
+    size_t n = timer_.expire(now);
+    auto lock = lockBound();
+    if (tw_.expire(now) > 0) filter_stale_ = true;
+    if (filter_ && filter_stale_ && now - filter_built_ >= RX_FILTER_REBUILD) refreshFilter();
+    return n;
+}
+
+void TCPEngine::refreshFilter()
+{
+    std::vector<SocketAddr> local;
+    local.reserve(bound.size() + tw_.size());
+    for (const auto& [addr, sock] : bound) local.push_back(addr);
+    // TIME_WAIT entries still have to see a retransmitted FIN
+    tw_.locals(local);
+    filter_set_ = RxFilter::build(local, RX_FILTER_ADDRS, RX_FILTER_PORTS);
+    filter_stale_ = false;
+    filter_built_ = now();
+    dev_->setFilter(filter_set_);
+}
+
+std::unique_lock<std::mutex> TCPEngine::lockBound()
+{
+    // the loop thread is the only one touching the table in loop mode
+    if (loopMode()) return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(bound_m_);
+}
+
 bool TCPEngine::bind(const SocketAddr& addr, std::shared_ptr<StreamSocket> socket) {
+    auto lock = lockBound();
     if (bound.find(addr) != bound.end()) {
         return false;
     }
-    timer_.insertSocket(socket);
     bound[addr] = socket;
+    if (filter_ && !filter_set_.covers(addr)) refreshFilter();
+    return true;
+}
+
+void TCPEngine::reclaim(StreamSocket& sock)
+{
+    if (!sock.closed_ || sock._state != SocketState::CLOSED) return;
+    if (sock.timer_refs_.load(std::memory_order_acquire) > 0) return; // the last timer entry retries
+    std::shared_ptr<StreamSocket> last;
+    {
+        auto lock = lockBound();
+        auto it = bound.find(sock._local_addr);
+        if (it == bound.end() || it->second.get() != &sock) return;
+        last = std::move(it->second);
+        bound.erase(it);
+        filter_stale_ = true;
+    }
+    metrics_.sockets_reclaimed_.add();
+    // last may be the final reference; it goes outside the lock
+}
+
+void TCPEngine::armTimer(StreamSocket* sock, TimePoint at)
+{
+    timer_.schedule(sock, at);
+}
+
+size_t TCPEngine::socketCount()
+{
+    auto lock = lockBound();
+    return bound.size();
+}
+
+size_t TCPEngine::timeWaitCount()
+{
+    auto lock = lockBound();
+    return tw_.size();
+}
+
+bool TCPEngine::claimTuple(StreamSocket& sock, const SocketAddr& peer)
+{
+    auto lock = lockBound();
+    const FourTuple t{sock._local_addr, peer};
+    TimeWaitEntry* e = tw_.find(t);
+    if (!e) return true;
+    if (now() - e->since_ < opts_.time_wait_reuse_) return false;
+    sock._send_buffer.setISS(e->snd_nxt_ + TIME_WAIT_ISS_GAP);
+    tw_.erase(t);
+    metrics_.time_wait_reuses_.add();
+    return true;
+}
+
+void TCPEngine::retire(StreamSocket& sock)
+{
+    if (sock._state == SocketState::TIME_WAIT)
+    {
+        {
+            auto lock = lockBound();
+            tw_.insert({sock._local_addr, sock._peer_addr}, sock._send_buffer.getSeqNumber(), sock._recv_buffer.getAckNumber(), now());
+        }
+        // the connection lives on in tw_; the socket is done
+        sock.setState(SocketState::CLOSED);
+    }
+    reclaim(sock);
+}
+
+bool TCPEngine::timeWaitSegment(const TCPHeader& tcphdr, const SocketAddr& src_addr, const SocketAddr& dst_addr, size_t payload_len, StreamSocket* listener)
+{
+    auto lock = lockBound();
+    const FourTuple t{dst_addr, src_addr};
+    TimeWaitEntry* e = tw_.find(t);
+    if (!e) return false;
+    uint8_t f = tcphdr.flags & (TCPFlag::SYN | TCPFlag::ACK | TCPFlag::FIN | TCPFlag::RST);
+    if (f == TCPFlag::SYN && listener && SEQ_GT(tcphdr.seq_num, e->rcv_nxt_))
+    {
+        // new incarnation (RFC 1122 4.2.2.13): the listener takes it
+        listener->_send_buffer.setISS(e->snd_nxt_ + TIME_WAIT_ISS_GAP);
+        tw_.erase(t);
+        metrics_.time_wait_reuses_.add();
+        return false;
+    }
+    metrics_.drops_[DROP_TIME_WAIT].add();
+    // RSTs are ignored (RFC 1337); a retransmitted FIN or stray data means
+    // our last ACK was lost, so it is repeated and the FIN restarts 2MSL
+    if ((f & TCPFlag::RST) || (!(f & TCPFlag::FIN) && payload_len == 0)) return true;
+    if (f & TCPFlag::FIN) tw_.restart(*e, now());
+    TCPSegment ack(nullptr, nullptr, e->snd_nxt_, 0, 0, TCPFlag::ACK);
+    const uint32_t ack_num = e->rcv_nxt_;
+    if (lock.owns_lock()) lock.unlock();
+    send(ack, dst_addr, src_addr, ack_num, 0);
     return true;
 }
 
-ssize_t TCPEngine::send(std::shared_ptr<TCPSegment>& seg, const SocketAddr& src_addr, const SocketAddr& dest_addr, const RecvBuffer& recv_buf)
+void TCPEngine::initTemplate(PacketTemplate& tmpl, const SocketAddr& src_addr, const SocketAddr& dest_addr) const
+{
+    tmpl.build(src_addr, dest_addr, opts_.tos_, opts_.dont_fragment_);
+}
+
+ssize_t TCPEngine::send(TCPSegment& seg, const PacketTemplate& tmpl, RecvBuffer& recv_buf)
 {
     // TODO: check socket state
-    auto nonconst = const_cast<std::byte*>(seg->data_);
-    TCPHeader* tcphdr = reinterpret_cast<TCPHeader*>(nonconst);
-    tcphdr->src_port = htons(src_addr.port);
-    tcphdr->dst_port = htons(dest_addr.port);
-    tcphdr->seq_num = htonl(seg->seq_start_);
-    tcphdr->ack_num = htonl(recv_buf.getAckNumber()); 
-    tcphdr->data_offset = (sizeof(TCPHeader) / 4) << 4;
-    tcphdr->flags = seg->flags_;
-    tcphdr->window_size = htons(recv_buf.getWindowSize()); 
-    tcphdr->checksum = 0;
-    tcphdr->urgent_pointer = 0;
-
-    PseudoIPv4Header iphdr;
-    iphdr.src_addr = htonl(src_addr.ip.addr);
-    iphdr.dst_addr = htonl(dest_addr.ip.addr);
-    iphdr.zero = 0;
-    iphdr.protocol = IPPROTO_TCP;
-    iphdr.tcp_length = htons(seg->len_);
-
-    InternetChecksumBuilder chksum;
-    chksum.add(&iphdr, sizeof(PseudoIPv4Header));
-    chksum.add(seg->data_, seg->len_);
-    tcphdr->checksum = htons(chksum.finalize());
-
-    sockaddr_in dst{};
-    dst.sin_family = AF_INET;
-    dst.sin_addr.s_addr = htonl(dest_addr.ip.addr);
-
-    seg->send_tmstp_ = std::chrono::steady_clock::now();
-    if (sendto(_raw_fd,
-                seg->data_, seg->len_,
-                0,
-                (sockaddr*)&dst, sizeof(dst))
-        < 0)
+    return send(seg, tmpl, recv_buf.getAckNumber(), recv_buf.advertiseWindow());
+}
+
+ssize_t TCPEngine::send(TCPSegment& seg, const SocketAddr& src_addr, const SocketAddr& dest_addr, uint32_t ack_num, uint16_t window)
+{
+    PacketTemplate tmpl;
+    initTemplate(tmpl, src_addr, dest_addr);
+    return send(seg, tmpl, ack_num, window);
+}
+
+size_t TCPEngine::maxSegment() const
+{
+    return opts_.gso_ ? GSO_MAX : TCP_MSS;
+}
+
+ssize_t TCPEngine::send(TCPSegment& seg, const PacketTemplate& tmpl, uint32_t ack_num, uint16_t window)
+{
+    seg.send_tmstp_ = now();
+    if (seg.len_ <= TCP_MSS || seg.len_ <= tso_max_) return transmit(seg, tmpl, ack_num, window);
+
+    // software GSO: PSH stays on the last packet only
+    TCPSegment rest = seg;
+    ssize_t total = 0;
+    while (rest.len_ > 0)
+    {
+        TCPSegment piece = rest;
+        piece.len_ = std::min<uint32_t>(rest.len_, TCP_MSS);
+        piece.brk_len_ = std::min(rest.brk_len_, piece.len_);
+        if (piece.len_ < rest.len_)
+        {
+            piece.flags_ &= ~TCPFlag::PSH;
+            rest.advance(piece.len_);
+        }
+        else
         {
-            perror("TCPEngine::sendto");
+            rest.len_ = 0;
+        }
+        ssize_t n = transmit(piece, tmpl, ack_num, window);
+        if (n < 0) return -1;
+        total += n;
+        metrics_.gso_packets_.add();
+    }
+    return total;
+}
+
+ssize_t TCPEngine::send(TCPSegment& seg, const PacketTemplate& tmpl, RecvBuffer& recv_buf, const TCPOptions& opts)
+{
+    seg.send_tmstp_ = now();
+    return transmit(seg, tmpl, recv_buf.getAckNumber(), recv_buf.advertiseWindow(), &opts);
+}
+
+ssize_t TCPEngine::transmit(const TCPSegment& seg, const PacketTemplate& tmpl, uint32_t ack_num, uint16_t window, const TCPOptions* opts)
+{
+    std::byte pkt[PacketTemplate::SIZE + 65535];
+    memcpy(pkt, tmpl.hdr_, PacketTemplate::SIZE);
+
+    // finish() sums whatever follows the fixed header, options included
+    size_t hdr_len = PacketTemplate::SIZE;
+    if (opts)
+    {
+        hdr_len += opts->write(pkt + hdr_len);
+        pkt[PacketTemplate::IP_SIZE + 12] = std::byte((hdr_len - PacketTemplate::IP_SIZE) / 4 << 4);
+    }
+
+    // payload may wrap around the send ring; a file mapping never wraps
+    if (seg.len_ > 0)
+    {
+        memcpy(pkt + hdr_len, seg.data_, seg.brk_len_);
+        if (seg.len_ > seg.brk_len_) memcpy(pkt + hdr_len + seg.brk_len_, seg.data2_, seg.len_ - seg.brk_len_);
+    }
+    size_t pkt_len = hdr_len + seg.len_;
+    // an atomic datagram needs no unique id (RFC 6864)
+    uint16_t id = opts_.dont_fragment_ ? 0 : ip_id_.fetch_add(1, std::memory_order_relaxed);
+    tmpl.finish(pkt, pkt_len, id, seg.seq_start_, ack_num, seg.flags_, window);
+
+    capture_.tapIPv4(pkt, pkt_len, true);
+
+    if (dev_->transmit(pkt, pkt_len) < 0)
+        {
+            perror("TCPEngine::transmit");
+            metrics_.drops_[DROP_TX_ERROR].add();
             return -1;
         }
-    return seg->len_;
+    metrics_.packets_out_.add();
+    metrics_.bytes_out_.add(pkt_len);
+    return pkt_len;
+}
+
+bool TCPEngine::validTCPPort(uint16_t port) const
+{
+    return port >= opts_.port_lo_ && port <= opts_.port_hi_;
 }
 
-bool validTCPPort(uint16_t port) {
-    return port >= 40000 && port <= 40010;
+void TCPEngine::requestBusyPoll(std::chrono::microseconds budget)
+{
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(budget).count();
+    int64_t cur = busy_poll_ns_.load();
+    while (cur < ns && !busy_poll_ns_.compare_exchange_weak(cur, ns));
+    if (cur >= ns) return;
+    dev_->setBusyPoll(budget);
+}
+
+EngineMetrics& TCPEngine::metrics()
+{
+    return metrics_;
+}
+
+FastOpen& TCPEngine::fastOpen()
+{
+    return fast_open_;
+}
+
+bool TCPEngine::fastOpenServer() const
+{
+    return opts_.fast_open_;
+}
+
+SlabPool<TCPSegment>& TCPEngine::segmentPool()
+{
+    return seg_pool_;
+}
+
+BufferPool& TCPEngine::bufferPool()
+{
+    return buf_pool_;
+}
+
+bool TCPEngine::startCapture(const CaptureOptions& opts)
+{
+    return capture_.start(opts);
+}
+
+void TCPEngine::stopCapture()
+{
+    capture_.stop();
+}
+
+const CaptureTap& TCPEngine::capture() const
+{
+    return capture_;
+}
+
+const LinkEmulator* TCPEngine::linkEmulator() const
+{
+    return link_.get();
+}
+
+BusyPollStats TCPEngine::getBusyPollStats() const
+{
+    return {rx_spin_hits_.get(), rx_sleeps_.get()};
+}
+
+ssize_t TCPEngine::recvSpin(std::byte* buffer, size_t len)
+{
+    const auto budget = std::chrono::nanoseconds(busy_poll_ns_.load(std::memory_order_relaxed));
+    if (budget.count() > 0)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + budget;
+        do
+        {
+            ssize_t n = dev_->receive(buffer, len, true);
+            if (n >= 0)
+            {
+                rx_spin_hits_.add();
+                return n;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return n;
+            cpuRelax();
+        } while (std::chrono::steady_clock::now() < deadline);
+        rx_sleeps_.add();
+    }
+    return dev_->receive(buffer, len, false);
 }
 
 void TCPEngine::recv() {
     std::byte buffer[65536];
     ssize_t data_size;
-    while (data_size = recvfrom(_raw_fd, buffer, sizeof(buffer), 0, nullptr, nullptr))
+    while (data_size = recvSpin(buffer, sizeof(buffer)))
     {
         if (data_size < 0) {
-            perror("TCPEngine::recvfrom");
+            perror("TCPEngine::receive");
+            metrics_.drops_[DROP_RX_ERROR].add();
             return;
         }
-        IPHeader ip_header(buffer);
-        if (!ip_header.nextProtoIsTCP()) continue;
+        rxPacket(buffer, data_size);
+        // whatever else is already queued joins the batch
+        for (size_t n = 1; n < opts_.rx_batch_; ++n)
+        {
+            data_size = dev_->receive(buffer, sizeof(buffer), true);
+            if (data_size < 0) break;
+            rxPacket(buffer, data_size);
+        }
+        rxFlush();
+    }
+}
+
+void TCPEngine::rxPacket(const std::byte* buffer, size_t data_size)
+{
+    metrics_.packets_in_.add();
+    metrics_.bytes_in_.add(data_size);
+    capture_.tapIPv4(buffer, data_size, false);
+    if (!opts_.rx_coalesce_)
+    {
+        rxProcess(buffer, data_size);
+        return;
+    }
+    if (gro_.add(buffer, data_size)) return;
+    rxFlush();
+    if (!gro_.add(buffer, data_size)) rxProcess(buffer, data_size);
+}
+
+void TCPEngine::rxFlush()
+{
+    if (gro_.empty()) return;
+    metrics_.rx_coalesced_.add(gro_.segments() - 1);
+    rxProcess(gro_.data(), gro_.size());
+    gro_.clear();
+}
+
+void TCPEngine::rxProcess(const std::byte* buffer, size_t data_size)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    processPacket(buffer, data_size);
+    metrics_.rx_process_ns_.record(std::chrono::steady_clock::now() - t0);
+}
+
+void TCPEngine::processPacket(const std::byte* buffer, size_t data_size)
+{
+    IPHeader ip_header(buffer);
+    if (!ip_header.nextProtoIsTCP())
+    {
+        metrics_.drops_[DROP_NOT_TCP].add();
+        return;
+    }
+
+    TCPHeader tcphdr(buffer + ip_header.getHeaderLength());
+
+    // TODO: validate checksum
+    // with a kernel filter only our own endpoints get this far
+    if (!filter_ && !validTCPPort(tcphdr.src_port) && !validTCPPort(tcphdr.dst_port))
+    {
+        metrics_.drops_[DROP_FOREIGN_PORT].add();
+        return;
+    }
+    if (ip_header.getVersion() != 4)
+    {
+        metrics_.drops_[DROP_BAD_VERSION].add();
+        return;
+    }
+
+    size_t tcphdr_sz = tcphdr.data_offset >> 2;
+    size_t payload_len = data_size - ip_header.getHeaderLength() - tcphdr_sz;
+    SocketAddr dst_addr(IPAddr(ip_header.dst_addr), tcphdr.dst_port);
+    SocketAddr src_addr(IPAddr(ip_header.src_addr), tcphdr.src_port);
+
+    std::shared_ptr<StreamSocket> sock;
+    bool time_wait = false;
+    {
+        auto lock = lockBound();
+        auto it = bound.find(dst_addr);
+        if (it != bound.end()) sock = it->second;
+        // the timer thread retires and expires entries under the same lock
+        time_wait = !tw_.empty();
+    }
+    // Only a connection already talking to this peer outranks a TIME_WAIT
+    // entry for the same tuple; checked after the bound lookup so live
+    // traffic pays nothing extra.
+    bool connected = sock && sock->_state != SocketState::LISTEN && sock->_state != SocketState::CLOSED && sock->_peer_addr == src_addr;
+    const std::byte* payload = buffer + ip_header.getHeaderLength() + tcphdr_sz;
+    if (connected && sock->fastPath(tcphdr, payload, payload_len))
+    {
+        metrics_.fast_path_.add();
+        if (payload_len == 0) return;
+        TCPSegment ack(nullptr, nullptr, sock->_send_buffer.getSeqNumber(), 0, 0, TCPFlag::ACK);
+        send(ack, sock->_send_buffer.headerTemplate(), sock->_recv_buffer);
+        return;
+    }
+    if (!connected && time_wait)
+    {
+        StreamSocket* listener = sock && sock->_state == SocketState::LISTEN ? sock.get() : nullptr;
+        if (timeWaitSegment(tcphdr, src_addr, dst_addr, payload_len, listener)) return;
+    }
+    if (!sock)
+    {
+        metrics_.drops_[DROP_NO_SOCKET].add();
+        return;
+    }
+
+    const SocketState from = sock->_state;
+    auto flags = sock->handleCntrl(tcphdr, src_addr, payload_len);
+
+    if (!flags) // packet was dropped
+    {
+        metrics_.drops_[DROP_FSM_REJECT].add();
+        if (connected && sock->ackRejected(tcphdr, payload_len))
+        {
+            metrics_.oow_acks_.add();
+            TCPSegment ack(nullptr, nullptr, sock->_send_buffer.getSeqNumber(), 0, 0, TCPFlag::ACK);
+            send(ack, sock->_send_buffer.headerTemplate(), sock->_recv_buffer);
+        }
+        return;
+    }
+
+    // options only matter on the opening handshake
+    if ((tcphdr.flags & TCPFlag::SYN) && *flags != TCPFlag::RST && tcphdr_sz >= 20)
+    {
+        TCPOptions opts(buffer + ip_header.getHeaderLength() + 20, tcphdr_sz - 20);
+        payload_len = sock->handleSynOptions(from, opts, payload_len);
+    }
+
+    bool consumes_seq = (tcphdr.flags & TCPFlag::SYN) || (tcphdr.flags & TCPFlag::FIN) || payload_len > 0;
+
+    if (consumes_seq)
+    {
+        sock->_recv_buffer.enqueue(payload, payload_len, tcphdr.seq_num, tcphdr.flags);
+        sock->notifyReadable();
+    }
+
+    uint8_t res_flags = *flags;
+    if (res_flags == 0) // no response
+    {
+        retire(*sock);
+        return;
+    }
+
+    bool response_consumes_seq = (res_flags & TCPFlag::SYN) || (res_flags & TCPFlag::FIN); // never responding with data
+    if (response_consumes_seq)
+    {
+        sock->_send_buffer.enqueue(nullptr, 0, res_flags);
+        return;
+    }
 
-        TCPHeader tcphdr(buffer + ip_header.getHeaderLength());
+    // response does not consume seq num (i.e. ack); nothing keeps it, so
+    // the descriptor lives on the stack
+    TCPSegment ack(
+        nullptr,
+        nullptr,
+        sock->_send_buffer.getSeqNumber(),
+        0,
+        0,
+        res_flags
+    );
 
-        // TODO: validate checksum
-        // TODO: validate ports
-        if (!validTCPPort(tcphdr.src_port) && !validTCPPort(tcphdr.dst_port)) continue;
-        if (ip_header.getVersion() != 4) continue;
+    send(ack, sock->_send_buffer.headerTemplate(), sock->_recv_buffer);
+    retire(*sock);
+}
 
-        size_t tcphdr_sz = tcphdr.data_offset >> 2;
-        size_t payload_len = data_size - ip_header.getHeaderLength() - tcphdr_sz;
-        SocketAddr dst_addr(IPAddr(ip_header.dst_addr), tcphdr.dst_port);
-        SocketAddr src_addr(IPAddr(ip_header.src_addr), tcphdr.src_port);
+bool TCPEngine::loopMode() const
+{
+    return opts_.mode_ == EngineMode::RUN_TO_COMPLETION;
+}
 
-        if (bound.find(dst_addr) == bound.end()) continue;
+bool TCPEngine::running() const
+{
+    return running_.load(std::memory_order_acquire);
+}
 
-        auto sock = bound[dst_addr];
-        
-        auto flags = sock->handleCntrl(tcphdr, src_addr, payload_len);
+TimePoint TCPEngine::now() const
+{
+    return opts_.clock_ ? opts_.clock_->now() : std::chrono::steady_clock::now();
+}
 
-        if (!flags) continue; // packet was dropped
+TimePoint TCPEngine::nextDeadline() const
+{
+    return std::min({timer_.nextExpiry(), tw_.nextExpiry(), dev_->nextDeadline()});
+}
 
-        bool consumes_seq = (tcphdr.flags & TCPFlag::SYN) || (tcphdr.flags & TCPFlag::FIN) || payload_len > 0;
-        
-        if (consumes_seq)
+size_t TCPEngine::pollRX()
+{
+    std::byte buffer[65536];
+    size_t n = 0;
+    for (; n < opts_.rx_batch_; ++n)
+    {
+        ssize_t data_size = dev_->receive(buffer, sizeof(buffer), true);
+        if (data_size < 0)
         {
-            sock->_recv_buffer.enqueue(buffer + ip_header.getHeaderLength() + tcphdr_sz, payload_len, tcphdr.seq_num, tcphdr.flags);
-            sock->cv_.notify_all();
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("TCPEngine::receive");
+                metrics_.drops_[DROP_RX_ERROR].add();
+            }
+            break;
         }
+        rxPacket(buffer, data_size);
+    }
+    rxFlush();
+    return n;
+}
 
-        uint8_t res_flags = *flags;
-        if (res_flags == 0) continue; // no response
+size_t TCPEngine::drainRequests()
+{
+    size_t n = requests_.drain(pending_);
+    for (auto& req : pending_)
+    {
+        req.sock_->handleRequest(req);
+        reclaim(*req.sock_);
+    }
+    pending_.clear();
+    return n;
+}
 
-        bool response_consumes_seq = (res_flags & TCPFlag::SYN) || (res_flags & TCPFlag::FIN); // never responding with data
-        if (response_consumes_seq)
+void TCPEngine::park()
+{
+    parked_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (requests_.empty() && running_.load(std::memory_order_relaxed))
+    {
+        pollfd fds[2] = {{wake_fd_, POLLIN, 0}, {dev_->pollFd(), POLLIN, 0}};
+        ::poll(fds, fds[1].fd >= 0 ? 2 : 1, opts_.idle_park_.count());
+        if (fds[0].revents & POLLIN)
         {
-            sock->_send_buffer.enqueue(nullptr, 0, res_flags);
-            continue;
+            uint64_t v;
+            ::read(wake_fd_, &v, sizeof(v));
         }
+    }
+    parked_.store(false, std::memory_order_relaxed);
+}
 
-        // response does not consume seq num (i.e. ack)
-        TCPHeader tmp;
+size_t TCPEngine::poll()
+{
+    size_t work = pollRX();
+    work += expireTimers(now());
+    work += drainRequests();
+    return work;
+}
 
-        auto p = std::make_shared<TCPSegment>(
-            reinterpret_cast<std::byte*>(&tmp),
-            nullptr,
-            sock->_send_buffer.getSeqNumber(),
-            sizeof(TCPHeader),
-            sizeof(TCPHeader),
-            res_flags
-        );
+void TCPEngine::run()
+{
+    running_ = true;
+    bool spinning = false;
+    std::chrono::steady_clock::time_point deadline;
+    while (running_.load(std::memory_order_relaxed))
+    {
+        if (poll() > 0)
+        {
+            if (spinning) rx_spin_hits_.add();
+            spinning = false;
+            continue;
+        }
+        const auto budget = std::chrono::nanoseconds(busy_poll_ns_.load(std::memory_order_relaxed));
+        if (budget.count() > 0)
+        {
+            // keep polling without parking until the budget is spent
+            const auto now = std::chrono::steady_clock::now();
+            if (!spinning)
+            {
+                spinning = true;
+                deadline = now + budget;
+            }
+            if (now < deadline)
+            {
+                cpuRelax();
+                continue;
+            }
+            rx_sleeps_.add();
+        }
+        spinning = false;
+        park();
+    }
+}
+
+void TCPEngine::stop()
+{
+    running_ = false;
+    uint64_t one = 1;
+    if (wake_fd_ >= 0) ::write(wake_fd_, &one, sizeof(one));
+}
 
-        send(p, sock->_local_addr, sock->_peer_addr, sock->_recv_buffer);
+void TCPEngine::post(SocketRequest&& req)
+{
+    requests_.push(std::move(req));
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed))
+    {
+        uint64_t one = 1;
+        ::write(wake_fd_, &one, sizeof(one));
     }
 }
 
@@ -0,0 +1,73 @@
+#include <TimeWaitTable.hpp>
+
+namespace ustacktcp {
+
+TimeWaitTable::TimeWaitTable(std::chrono::steady_clock::duration timeout) : timeout_(timeout) {}
+
+void TimeWaitTable::insert(const FourTuple& t, uint32_t snd_nxt, uint32_t rcv_nxt, TimePoint now)
+{
+    TimeWaitEntry e{snd_nxt, rcv_nxt, now, now + timeout_};
+    map_[t] = e;
+    fifo_.emplace_back(t, e.expiry_);
+}
+
+TimeWaitEntry* TimeWaitTable::find(const FourTuple& t)
+{
+    auto it = map_.find(t);
+    return it == map_.end() ? nullptr : &it->second;
+}
+
+void TimeWaitTable::erase(const FourTuple& t)
+{
+    // the FIFO slot goes stale and is skipped by expire()
+    map_.erase(t);
+}
+
+void TimeWaitTable::restart(TimeWaitEntry& e, TimePoint now)
+{
+    e.expiry_ = now + timeout_;
+}
+
+size_t TimeWaitTable::expire(TimePoint now)
+{
+    size_t n = 0;
+    while (!fifo_.empty() && fifo_.front().second <= now)
+    {
+        auto [t, at] = fifo_.front();
+        fifo_.pop_front();
+        auto it = map_.find(t);
+        if (it == map_.end()) continue;  // erased or reused
+        if (it->second.expiry_ > at)
+        {
+            // restarted since this slot was queued (or erased and inserted
+            // again, in which case the requeued slot is a harmless duplicate)
+            fifo_.emplace_back(t, it->second.expiry_);
+            continue;
+        }
+        map_.erase(it);
+        n++;
+    }
+    return n;
+}
+
+TimePoint TimeWaitTable::nextExpiry() const
+{
+    return fifo_.empty() ? TimePoint::max() : fifo_.front().second;
+}
+
+void TimeWaitTable::locals(std::vector<SocketAddr>& out) const
+{
+    for (const auto& [t, e] : map_) out.push_back(t.local_);
+}
+
+size_t TimeWaitTable::size() const
+{
+    return map_.size();
+}
+
+bool TimeWaitTable::empty() const
+{
+    return map_.empty();
+}
+
+}
@@ -1,6 +1,6 @@
-#include <thread>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
 
 #include <TimerManager.hpp>
 #include <StreamSocket.hpp>
@@ -8,37 +8,97 @@
 
 namespace ustacktcp {
 
-void TimerManager::insertSocket(const std::shared_ptr<StreamSocket>& sock)
+TimerManager::TimerManager(MetricCounter& fires) : fires_(fires) {}
+
+void TimerManager::setShared(bool shared)
+{
+    shared_ = shared;
+}
+
+void TimerManager::lock() const
+{
+    if (shared_) m_.lock();
+}
+
+void TimerManager::unlock() const
 {
-    sock_.push_back(sock);
+    if (shared_) m_.unlock();
 }
 
-void TimerManager::timeoutLoop()
+void TimerManager::schedule(StreamSocket* sock, TimePoint at)
 {
-    while (true)
+    lock();
+    if (at < sock->timer_at_)
     {
-        const auto now = std::chrono::steady_clock::now();
-        for (const auto p : sock_)
+        q_.push({at, sock});
+        sock->timer_at_ = at;
+        sock->timer_refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    unlock();
+}
+
+size_t TimerManager::expire(const TimePoint now)
+{
+    lock();
+    while (!q_.empty() && q_.top().at_ <= now)
+    {
+        Entry e = q_.top();
+        q_.pop();
+        StreamSocket* p = e.sock_;
+        if (p->timer_at_ == e.at_) p->timer_at_ = TimePoint::max();
+        // refs drop only after the socket is handled below
+        p->timer_popped_++;
+        if (!p->timer_due_)
         {
-            SocketState s;
-            {
-                std::lock_guard lock(p->m_);
-                s = p->_state;
-            }
-            if (s != SocketState::CLOSED && p->_send_buffer.getRTOExpiry() < now)
-            {
-                p->_send_buffer.handleRTO();
-            }
-            s = p->_state;
-            if (s == SocketState::TIME_WAIT && p->time_wait_expiry_ < now)
-            {
-                p->timeWaitTO();
-            }
+            p->timer_due_ = true;
+            due_.push_back(p->shared_from_this());
+        }
+    }
+    unlock();
 
+    size_t fired = 0;
+    for (const auto& p : due_)
+    {
+        SocketState s = p->_state;
+        auto& sb = p->_send_buffer;
+        if (s != SocketState::CLOSED && sb.rtoArmed() && sb.getRTOExpiry() <= now && sb.handleRTO())
+        {
+            ++fired;
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (s != SocketState::CLOSED && sb.persistArmed() && sb.getPersistExpiry() <= now && sb.handlePersist())
+        {
+            ++fired;
+        }
+        // requeue at whatever is still armed
+        TimePoint next = p->nextTimer();
+        if (next != TimePoint::max()) schedule(p.get(), next);
+
+        lock();
+        p->timer_refs_.fetch_sub(p->timer_popped_, std::memory_order_release);
+        p->timer_popped_ = 0;
+        p->timer_due_ = false;
+        unlock();
+        p->_engine.reclaim(*p);
     }
+    due_.clear();
+    if (fired) fires_.add(fired);
+    return fired;
 }
 
+TimePoint TimerManager::nextExpiry() const
+{
+    lock();
+    TimePoint t = q_.empty() ? TimePoint::max() : q_.top().at_;
+    unlock();
+    return t;
+}
+
+size_t TimerManager::size() const
+{
+    lock();
+    size_t n = q_.size();
+    unlock();
+    return n;
+}
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,230 @@
+#include <TunDevice.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+namespace ustacktcp {
+
+namespace {
+
+// struct VnetHdr; <linux/virtio_net.h> does not compile as C++
+struct VnetHdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+};
+constexpr uint8_t VNET_F_NEEDS_CSUM = 1;
+constexpr uint8_t VNET_GSO_NONE = 0;
+constexpr uint8_t VNET_GSO_TCPV4 = 1;
+
+// address, netmask, MTU and IFF_UP on the interface
+bool configure(const TunOptions& opts)
+{
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0)
+    {
+        perror("TunDevice::socket");
+        return false;
+    }
+    ifreq ifr{};
+    strncpy(ifr.ifr_name, opts.name_.c_str(), IFNAMSIZ - 1);
+    auto set_addr = [&](unsigned long req, uint32_t addr, const char* what) {
+        sockaddr_in sin{};
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(addr);
+        memcpy(&ifr.ifr_addr, &sin, sizeof(sin));
+        if (ioctl(s, req, &ifr) < 0)
+        {
+            perror(what);
+            return false;
+        }
+        return true;
+    };
+    const uint32_t mask = opts.prefix_len_ == 0 ? 0 : ~0u << (32 - opts.prefix_len_);
+    bool ok = set_addr(SIOCSIFADDR, opts.host_addr_, "TunDevice::ioctl(SIOCSIFADDR)")
+        && set_addr(SIOCSIFNETMASK, mask, "TunDevice::ioctl(SIOCSIFNETMASK)");
+    if (ok)
+    {
+        ifr.ifr_mtu = opts.mtu_;
+        if (ioctl(s, SIOCSIFMTU, &ifr) < 0)
+        {
+            perror("TunDevice::ioctl(SIOCSIFMTU)");
+            ok = false;
+        }
+    }
+    if (ok && ioctl(s, SIOCGIFFLAGS, &ifr) == 0)
+    {
+        ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+        if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0)
+        {
+            perror("TunDevice::ioctl(SIOCSIFFLAGS)");
+            ok = false;
+        }
+    }
+    close(s);
+    return ok;
+}
+
+}
+
+std::vector<std::shared_ptr<TunDevice>> TunDevice::open(const TunOptions& opts)
+{
+    std::vector<std::shared_ptr<TunDevice>> queues;
+    const size_t mss = opts.mtu_ - 40;
+    for (size_t i = 0; i < std::max<size_t>(opts.queues_, 1); ++i)
+    {
+        int fd = ::open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+        {
+            perror("TunDevice::open");
+            return {};
+        }
+        ifreq ifr{};
+        strncpy(ifr.ifr_name, opts.name_.c_str(), IFNAMSIZ - 1);
+        ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+        if (opts.vnet_hdr_) ifr.ifr_flags |= IFF_VNET_HDR;
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+        {
+            perror("TunDevice::ioctl(TUNSETIFF)");
+            close(fd);
+            return {};
+        }
+        // the device closes fd from here on
+        queues.emplace_back(new TunDevice(fd, opts.vnet_hdr_, mss));
+        if (opts.vnet_hdr_)
+        {
+            int sz = sizeof(VnetHdr);
+            // partially checksummed and TSO packets may be handed to us
+            unsigned offload = TUN_F_CSUM | TUN_F_TSO4;
+            if (ioctl(fd, TUNSETVNETHDRSZ, &sz) < 0 || ioctl(fd, TUNSETOFFLOAD, offload) < 0)
+            {
+                perror("TunDevice::ioctl(TUNSETOFFLOAD)");
+                return {};
+            }
+        }
+    }
+    if (opts.host_addr_ != 0 && !configure(opts)) return {};
+    return queues;
+}
+
+TunDevice::TunDevice(int fd, bool vnet, size_t mss) : fd_(fd), vnet_(vnet), mss_(mss) {}
+
+TunDevice::~TunDevice()
+{
+    close(fd_);
+}
+
+ssize_t TunDevice::transmit(const std::byte* pkt, size_t len)
+{
+    if (!vnet_) return ::write(fd_, pkt, len) < 0 ? -1 : (ssize_t)len;
+
+    VnetHdr vh{};
+    const size_t ihl = (std::to_integer<uint8_t>(pkt[0]) & 0x0F) * 4;
+    const size_t hdr_len = ihl + (std::to_integer<uint8_t>(pkt[ihl + 12]) >> 4) * 4;
+    if (len - hdr_len <= mss_)
+    {
+        // checksums already complete
+        iovec iov[2] = {{&vh, sizeof(vh)}, {const_cast<std::byte*>(pkt), len}};
+        return writev(fd_, iov, 2) < 0 ? -1 : (ssize_t)len;
+    }
+
+    // TSO: the kernel cuts MSS-sized segments and finishes each checksum
+    // from the pseudo-header sum left in the TCP header
+    vh.flags = VNET_F_NEEDS_CSUM;
+    vh.gso_type = VNET_GSO_TCPV4;
+    vh.hdr_len = hdr_len;
+    vh.gso_size = mss_;
+    vh.csum_start = ihl;
+    vh.csum_offset = 16;
+
+    std::byte hdrs[120];
+    memcpy(hdrs, pkt, hdr_len);
+    PseudoIPv4Header ph;
+    memcpy(&ph.src_addr, pkt + 12, sizeof(ph.src_addr));
+    memcpy(&ph.dst_addr, pkt + 16, sizeof(ph.dst_addr));
+    ph.zero = 0;
+    ph.protocol = IPPROTO_TCP;
+    ph.tcp_length = htons(len - ihl);
+    InternetChecksumBuilder partial;
+    partial.add(&ph, sizeof(ph));
+    uint16_t psum = htons(~partial.finalize());
+    memcpy(hdrs + ihl + 16, &psum, sizeof(psum));
+
+    iovec iov[3] = {
+        {&vh, sizeof(vh)},
+        {hdrs, hdr_len},
+        {const_cast<std::byte*>(pkt) + hdr_len, len - hdr_len}
+    };
+    if (writev(fd_, iov, 3) < 0) return -1;
+    tx_super_.add();
+    return len;
+}
+
+ssize_t TunDevice::receive(std::byte* buf, size_t len, bool nonblock)
+{
+    while (true)
+    {
+        ssize_t n;
+        if (vnet_)
+        {
+            VnetHdr vh;
+            iovec iov[2] = {{&vh, sizeof(vh)}, {buf, len}};
+            n = readv(fd_, iov, 2);
+            if (n >= (ssize_t)sizeof(vh))
+            {
+                if (vh.gso_type != VNET_GSO_NONE) rx_coalesced_.add();
+                return n - sizeof(vh);
+            }
+        }
+        else
+        {
+            n = read(fd_, buf, len);
+            if (n >= 0) return n;
+        }
+        if (n >= 0 || errno != EAGAIN || nonblock) return -1;
+        pollfd pfd{fd_, POLLIN, 0};
+        ::poll(&pfd, 1, -1);
+    }
+}
+
+int TunDevice::pollFd() const
+{
+    return fd_;
+}
+
+bool TunDevice::setFilter(const RxFilter&)
+{
+    return true;
+}
+
+size_t TunDevice::maxSegment() const
+{
+    return vnet_ ? 65535 - 20 - 60 : mss_;
+}
+
+uint64_t TunDevice::rxCoalesced() const
+{
+    return rx_coalesced_.get();
+}
+
+uint64_t TunDevice::txSuperSegments() const
+{
+    return tx_super_.get();
+}
+
+}
@@ -1,6 +1,7 @@
 #include <types.hpp>
 
 #include <iostream>
+#include <cstring>
 #include <arpa/inet.h>
 
 namespace ustacktcp {
@@ -72,6 +73,45 @@ bool SocketAddr::operator==(const SocketAddr& other) const
     return (ip == other.ip) && (port == other.port);
 }
 
+TCPOptions::TCPOptions(const std::byte* buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        const uint8_t kind = std::to_integer<uint8_t>(buf[i]);
+        if (kind == 0) break;  // end of option list
+        if (kind == 1)         // NOP
+        {
+            ++i;
+            continue;
+        }
+        if (i + 1 >= len) break;
+        const uint8_t olen = std::to_integer<uint8_t>(buf[i + 1]);
+        if (olen < 2 || i + olen > len) break;
+        if (kind == KIND_FAST_OPEN && olen <= 2 + COOKIE_MAX)
+        {
+            fast_open_ = true;
+            cookie_len_ = olen - 2;
+            memcpy(cookie_, buf + i + 2, cookie_len_);
+        }
+        i += olen;
+    }
+}
+
+size_t TCPOptions::write(std::byte* buf) const
+{
+    size_t n = 0;
+    if (fast_open_)
+    {
+        buf[n++] = std::byte{KIND_FAST_OPEN};
+        buf[n++] = std::byte(2 + cookie_len_);
+        memcpy(buf + n, cookie_, cookie_len_);
+        n += cookie_len_;
+    }
+    while (n % 4 != 0) buf[n++] = std::byte{1};
+    return n;
+}
+
 PseudoIPv4Header::PseudoIPv4Header() {};
 
 PseudoIPv4Header::PseudoIPv4Header(uint32_t src, uint32_t dst, uint16_t tcp_len)
@@ -98,6 +138,25 @@ int PseudoIPv4Header::writeNetworkBytes(std::byte* buf) const
 
 InternetChecksumBuilder::InternetChecksumBuilder() : _sum(0) {}
 
+InternetChecksumBuilder::InternetChecksumBuilder(uint32_t partial) : _sum(partial)
+{
+    while (_sum & 0xFFFF0000) _sum = (_sum & 0xFFFF) + (_sum >> 16);
+}
+
+void InternetChecksumBuilder::addWord(uint16_t word)
+{
+    _sum += word;
+    if (_sum & 0xFFFF0000)
+    {
+        _sum = (_sum & 0xFFFF) + (_sum >> 16);
+    }
+}
+
+uint32_t InternetChecksumBuilder::partial() const
+{
+    return _sum;
+}
+
 void InternetChecksumBuilder::add(const void* buf, size_t len)
 {
     const uint16_t* words = reinterpret_cast<const uint16_t*>(buf);
@@ -125,6 +184,56 @@ uint16_t InternetChecksumBuilder::finalize()
     return (uint16_t)(~_sum);
 }
 
+void PacketTemplate::build(const SocketAddr& src, const SocketAddr& dst, uint8_t tos, bool dont_fragment)
+{
+    uint8_t* h = reinterpret_cast<uint8_t*>(hdr_);
+    memset(h, 0, SIZE);
+    h[0] = 0x45;
+    h[1] = tos;
+    if (dont_fragment) h[6] = 0x40;
+    h[8] = 64;
+    h[9] = IPPROTO_TCP;
+    uint32_t s = htonl(src.ip.addr), d = htonl(dst.ip.addr);
+    memcpy(h + 12, &s, sizeof(s));
+    memcpy(h + 16, &d, sizeof(d));
+    InternetChecksumBuilder ip;
+    ip.add(h, IP_SIZE);
+    ip_sum_ = ip.partial();
+
+    uint8_t* t = h + IP_SIZE;
+    uint16_t sp = htons(src.port), dp = htons(dst.port);
+    memcpy(t, &sp, sizeof(sp));
+    memcpy(t + 2, &dp, sizeof(dp));
+    t[12] = (SIZE - IP_SIZE) / 4 << 4;
+    InternetChecksumBuilder tcp;
+    tcp.add(h + 12, 8);       // addresses
+    tcp.addWord(IPPROTO_TCP);
+    tcp.add(t, 4);            // ports
+    tcp_sum_ = tcp.partial();
+}
+
+void PacketTemplate::finish(std::byte* pkt, size_t len, uint16_t ip_id, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window) const
+{
+    uint8_t* h = reinterpret_cast<uint8_t*>(pkt);
+    auto put16 = [](uint8_t* p, uint16_t v) { v = htons(v); memcpy(p, &v, sizeof(v)); };
+    auto put32 = [](uint8_t* p, uint32_t v) { v = htonl(v); memcpy(p, &v, sizeof(v)); };
+
+    put16(h + 2, len);
+    put16(h + 4, ip_id);
+    InternetChecksumBuilder ip(ip_sum_ + len + ip_id);
+    put16(h + 10, ip.finalize());
+
+    uint8_t* t = h + IP_SIZE;
+    const uint16_t tcp_len = len - IP_SIZE;
+    put32(t + 4, seq);
+    put32(t + 8, ack);
+    t[13] = flags;
+    put16(t + 14, window);
+    InternetChecksumBuilder tcp(tcp_sum_ + tcp_len + (seq >> 16) + (seq & 0xFFFF) + (ack >> 16) + (ack & 0xFFFF) + ((t[12] << 8) | flags) + window);
+    tcp.add(t + 20, len - SIZE);
+    put16(t + 16, tcp.finalize());
+}
+
 IPHeader::IPHeader(const std::byte* buf)
 {
     version_ihl = std::to_integer<uint8_t>(buf[0]);
@@ -0,0 +1,65 @@
+#include <AllocCounter.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+
+namespace {
+
+std::atomic<uint64_t> g_allocs = 0;
+std::atomic<uint64_t> g_bytes = 0;
+std::atomic<int64_t> g_live = 0;
+
+void* countedAlloc(size_t sz)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(sz, std::memory_order_relaxed);
+    void* p = malloc(sz ? sz : 1);
+    if (!p) throw std::bad_alloc();
+    g_live.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+    return p;
+}
+
+void* countedAlignedAlloc(size_t sz, std::align_val_t al)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(sz, std::memory_order_relaxed);
+    size_t a = static_cast<size_t>(al);
+    void* p = aligned_alloc(a, (sz + a - 1) / a * a);
+    if (!p) throw std::bad_alloc();
+    g_live.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+    return p;
+}
+
+void countedFree(void* p)
+{
+    if (!p) return;
+    g_live.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    free(p);
+}
+
+}
+
+namespace ustacktcp {
+
+uint64_t allocCount() { return g_allocs.load(std::memory_order_relaxed); }
+
+uint64_t allocBytes() { return g_bytes.load(std::memory_order_relaxed); }
+
+int64_t liveBytes() { return g_live.load(std::memory_order_relaxed); }
+
+}
+
+void* operator new(size_t sz) { return countedAlloc(sz); }
+void* operator new[](size_t sz) { return countedAlloc(sz); }
+void* operator new(size_t sz, std::align_val_t al) { return countedAlignedAlloc(sz, al); }
+void* operator new[](size_t sz, std::align_val_t al) { return countedAlignedAlloc(sz, al); }
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { countedFree(p); }
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ustacktcp {
+
+// Linking AllocCounter.cpp into a program replaces global operator
+// new/delete with counting versions.
+uint64_t allocCount();
+
+uint64_t allocBytes();
+
+// heap bytes currently held (malloc usable size)
+int64_t liveBytes();
+
+}
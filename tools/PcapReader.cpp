@@ -0,0 +1,205 @@
+#include <PcapReader.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+namespace ustacktcp {
+
+namespace {
+
+constexpr uint32_t LINKTYPE_NULL = 0;
+constexpr uint32_t LINKTYPE_ETHERNET = 1;
+constexpr uint32_t LINKTYPE_RAW = 101;
+constexpr uint32_t LINKTYPE_LINUX_SLL = 113;
+constexpr uint32_t LINKTYPE_IPV4 = 228;
+constexpr uint32_t LINKTYPE_LINUX_SLL2 = 276;
+
+struct Cursor {
+    const std::vector<std::byte>& buf_;
+    bool swap_;
+
+    uint16_t u16(size_t off) const
+    {
+        uint16_t v;
+        memcpy(&v, buf_.data() + off, sizeof(v));
+        return swap_ ? __builtin_bswap16(v) : v;
+    }
+
+    uint32_t u32(size_t off) const
+    {
+        uint32_t v;
+        memcpy(&v, buf_.data() + off, sizeof(v));
+        return swap_ ? __builtin_bswap32(v) : v;
+    }
+};
+
+uint16_t be16(const std::byte* p)
+{
+    return (std::to_integer<uint16_t>(p[0]) << 8) | std::to_integer<uint16_t>(p[1]);
+}
+
+// Strips the link header; returns false for anything but IPv4/TCP
+bool extractIPv4(uint32_t linktype, const std::byte* p, size_t len, PcapPacket& pkt)
+{
+    size_t off = 0;
+    switch (linktype)
+    {
+        case LINKTYPE_ETHERNET:
+        {
+            if (len < 14) return false;
+            uint16_t ethertype = be16(p + 12);
+            off = 14;
+            while ((ethertype == 0x8100 || ethertype == 0x88A8) && len >= off + 4)
+            {
+                ethertype = be16(p + off + 2);
+                off += 4;
+            }
+            if (ethertype != 0x0800) return false;
+            break;
+        }
+        case LINKTYPE_LINUX_SLL:
+            if (len < 16 || be16(p + 14) != 0x0800) return false;
+            off = 16;
+            break;
+        case LINKTYPE_LINUX_SLL2:
+            if (len < 20 || be16(p) != 0x0800) return false;
+            off = 20;
+            break;
+        case LINKTYPE_NULL:
+        {
+            if (len < 4) return false;
+            uint32_t family;
+            memcpy(&family, p, sizeof(family));
+            if (family != AF_INET && __builtin_bswap32(family) != AF_INET) return false;
+            off = 4;
+            break;
+        }
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+            break;
+        default:
+            return false;
+    }
+    if (len < off + 20) return false;
+    const std::byte* ip = p + off;
+    if ((std::to_integer<uint8_t>(ip[0]) >> 4) != 4) return false;
+    if (std::to_integer<uint8_t>(ip[9]) != IPPROTO_TCP) return false;
+    size_t ip_len = std::min<size_t>(be16(ip + 2), len - off);
+    pkt.ip_.assign(ip, ip + ip_len);
+    return true;
+}
+
+bool readClassic(const std::vector<std::byte>& buf, std::vector<PcapPacket>& out, std::string& err)
+{
+    uint32_t magic;
+    memcpy(&magic, buf.data(), sizeof(magic));
+    bool swap = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+    bool nsec = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+    Cursor c{buf, swap};
+    if (buf.size() < 24)
+    {
+        err = "truncated pcap header";
+        return false;
+    }
+    uint32_t linktype = c.u32(20) & 0x0FFFFFFF;
+    size_t off = 24;
+    while (off + 16 <= buf.size())
+    {
+        uint64_t sec = c.u32(off), frac = c.u32(off + 4);
+        uint32_t incl = c.u32(off + 8);
+        off += 16;
+        if (off + incl > buf.size()) break;
+        PcapPacket pkt;
+        pkt.ts_ns_ = sec * 1000000000ull + (nsec ? frac : frac * 1000);
+        if (extractIPv4(linktype, buf.data() + off, incl, pkt)) out.push_back(std::move(pkt));
+        off += incl;
+    }
+    return true;
+}
+
+bool readNG(const std::vector<std::byte>& buf, std::vector<PcapPacket>& out, std::string& err)
+{
+    std::vector<uint32_t> linktypes;
+    bool swap = false;
+    size_t off = 0;
+    while (off + 12 <= buf.size())
+    {
+        Cursor c{buf, swap};
+        uint32_t type = c.u32(off);
+        if (type == 0x0A0D0D0A)
+        {
+            uint32_t bom;
+            memcpy(&bom, buf.data() + off + 8, sizeof(bom));
+            swap = (bom == 0x4D3C2B1A);
+            c.swap_ = swap;
+            linktypes.clear();
+        }
+        uint32_t blen = c.u32(off + 4);
+        if (blen < 12 || off + blen > buf.size())
+        {
+            err = "truncated pcapng block";
+            return false;
+        }
+        if (type == 1)
+        {
+            linktypes.push_back(c.u16(off + 8));
+        }
+        else if (type == 6)
+        {
+            uint32_t ifid = c.u32(off + 8);
+            uint32_t caplen = c.u32(off + 20);
+            if (ifid < linktypes.size() && 28 + caplen <= blen)
+            {
+                PcapPacket pkt;
+                // assumes the default microsecond if_tsresol unless it is 9
+                pkt.ts_ns_ = ((uint64_t)c.u32(off + 12) << 32) | c.u32(off + 16);
+                if (extractIPv4(linktypes[ifid], buf.data() + off + 28, caplen, pkt)) out.push_back(std::move(pkt));
+            }
+        }
+        else if (type == 3 && !linktypes.empty())
+        {
+            PcapPacket pkt;
+            pkt.ts_ns_ = 0;
+            if (extractIPv4(linktypes[0], buf.data() + off + 12, std::min<size_t>(c.u32(off + 8), blen - 16), pkt)) out.push_back(std::move(pkt));
+        }
+        off += blen;
+    }
+    return true;
+}
+
+}
+
+bool readPcap(const std::string& path, std::vector<PcapPacket>& out, std::string& err)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        err = "cannot open " + path;
+        return false;
+    }
+    std::vector<char> raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<std::byte> buf(raw.size());
+    memcpy(buf.data(), raw.data(), raw.size());
+    if (buf.size() < 4)
+    {
+        err = "file too short";
+        return false;
+    }
+    uint32_t magic;
+    memcpy(&magic, buf.data(), sizeof(magic));
+    switch (magic)
+    {
+        case 0xa1b2c3d4: case 0xd4c3b2a1: case 0xa1b23c4d: case 0x4d3cb2a1:
+            return readClassic(buf, out, err);
+        case 0x0A0D0D0A:
+            return readNG(buf, out, err);
+        default:
+            err = "not a pcap/pcapng file";
+            return false;
+    }
+}
+
+}
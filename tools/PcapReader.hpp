@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ustacktcp {
+
+struct PcapPacket {
+    uint64_t ts_ns_;
+    std::vector<std::byte> ip_;  // IPv4 packet, link header stripped
+};
+
+// Reads classic pcap (us/ns, either byte order) and pcapng captures and
+// returns the IPv4/TCP packets. Supported link types: Ethernet (with VLAN
+// tags), raw IP, Linux cooked (SLL, SLL2) and BSD loopback.
+bool readPcap(const std::string& path, std::vector<PcapPacket>& out, std::string& err);
+
+}
@@ -0,0 +1,253 @@
+// Offline replay of a pcap/pcapng capture through the TCP RX path.
+//
+// The first SYN in the capture picks the server side; every client->server
+// packet of that connection is fed to TCPEngine::processPacket with no
+// kernel, NIC or socket in between. Whatever the engine transmits goes to a
+// counting sink device, so the run measures pure protocol processing.
+//
+// Build (from the repository root):
+//   g++ -std=c++20 -O2 -Iinclude -Itools $(ls src/*.cpp | grep -v main.cpp)
+//       tools/PcapReader.cpp tools/AllocCounter.cpp tools/pcap_replay.cpp
+//       -o pcap_replay -pthread
+//
+// Usage: pcap_replay [--iterations N] [--json] capture.pcap
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+
+#include <TCPEngine.hpp>
+#include <StreamSocket.hpp>
+#include <NetDevice.hpp>
+#include <PcapReader.hpp>
+#include <AllocCounter.hpp>
+
+using namespace ustacktcp;
+
+// Stands in for the wire: counts what the engine transmits and remembers
+// the sequence number of its SYN so client ACKs can be rebased
+class SinkDevice : public NetDevice {
+    public:
+        uint64_t tx_packets_ = 0;
+        uint64_t tx_bytes_ = 0;
+        uint32_t isn_ = 0;
+        bool isn_seen_ = false;
+
+        ssize_t transmit(const std::byte* pkt, size_t len) override
+        {
+            tx_packets_++;
+            tx_bytes_ += len;
+            size_t ihl = (std::to_integer<uint8_t>(pkt[0]) & 0x0F) * 4;
+            if (!isn_seen_ && len >= ihl + 20)
+            {
+                TCPHeader hdr(pkt + ihl);
+                if (hdr.flags & TCPFlag::SYN)
+                {
+                    isn_ = hdr.seq_num;
+                    isn_seen_ = true;
+                }
+            }
+            return len;
+        }
+
+        ssize_t receive(std::byte*, size_t, bool) override
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        int pollFd() const override
+        {
+            return -1;
+        }
+};
+
+struct ReplayPacket {
+    std::vector<std::byte> ip_;
+    size_t ack_off_;     // offset of the TCP ack field inside ip_
+    uint32_t ack_;       // ack number as captured, host order
+    bool has_ack_;
+};
+
+struct ReplayResult {
+    double seconds_ = 0;
+    uint64_t packets_ = 0;
+    uint64_t allocs_ = 0;
+    uint64_t alloc_bytes_ = 0;
+    uint64_t delivered_ = 0;
+    uint64_t tx_packets_ = 0;
+};
+
+static void usage()
+{
+    std::cerr << "usage: pcap_replay [--iterations N] [--json] capture.pcap" << std::endl;
+}
+
+// Picks the connection and the server's ISN as seen in the capture
+static bool selectFlow(const std::vector<PcapPacket>& pkts, SocketAddr& server, SocketAddr& client,
+                       std::vector<ReplayPacket>& out, uint32_t& cap_isn)
+{
+    bool found = false;
+    for (auto& p : pkts)
+    {
+        IPHeader ip(p.ip_.data());
+        size_t ihl = ip.getHeaderLength();
+        if (p.ip_.size() < ihl + 20) continue;
+        TCPHeader tcp(p.ip_.data() + ihl);
+        if (!found)
+        {
+            if ((tcp.flags & TCPFlag::SYN) && !(tcp.flags & TCPFlag::ACK))
+            {
+                server = SocketAddr(IPAddr(ip.dst_addr), tcp.dst_port);
+                client = SocketAddr(IPAddr(ip.src_addr), tcp.src_port);
+                found = true;
+            }
+            else continue;
+        }
+        SocketAddr src(IPAddr(ip.src_addr), tcp.src_port);
+        SocketAddr dst(IPAddr(ip.dst_addr), tcp.dst_port);
+        if (src == server && dst == client && (tcp.flags & TCPFlag::SYN))
+        {
+            cap_isn = tcp.seq_num;
+        }
+        if (!(src == client && dst == server)) continue;
+        if (out.empty() == false && (tcp.flags & TCPFlag::SYN)) continue; // retransmitted SYN
+        out.push_back({p.ip_, ihl + 8, tcp.ack_num, (tcp.flags & TCPFlag::ACK) != 0});
+    }
+    if (found && cap_isn == 0)
+    {
+        // no SYN|ACK in the capture: infer it from the handshake ACK
+        for (auto& r : out)
+        {
+            if (r.has_ack_)
+            {
+                cap_isn = r.ack_ - 1;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+static ReplayResult replayOnce(std::vector<ReplayPacket>& pkts, const SocketAddr& server, uint32_t cap_isn)
+{
+    auto sink = std::make_shared<SinkDevice>();
+    EngineOptions opts;
+    opts.mode_ = EngineMode::RUN_TO_COMPLETION;
+    opts.device_ = sink;
+    opts.port_lo_ = 0;
+    opts.port_hi_ = 65535;
+    TCPEngine engine(opts);
+
+    auto sock = make_socket(engine);
+    sock->bind(server);
+    sock->listenAsync();
+    while (sock->_state != SocketState::LISTEN) engine.poll();
+
+    std::byte buf[65536];
+    ReplayResult res;
+    uint64_t allocs0 = allocCount(), bytes0 = allocBytes();
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto& p : pkts)
+    {
+        if (p.has_ack_ && sink->isn_seen_)
+        {
+            uint32_t ack = htonl(p.ack_ - cap_isn + sink->isn_);
+            memcpy(p.ip_.data() + p.ack_off_, &ack, sizeof(ack));
+        }
+        engine.processPacket(p.ip_.data(), p.ip_.size());
+        ssize_t n;
+        while ((n = sock->tryRecv(buf, sizeof(buf))) > 0) res.delivered_ += n;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    res.allocs_ = allocCount() - allocs0;
+    res.alloc_bytes_ = allocBytes() - bytes0;
+    res.seconds_ = std::chrono::duration<double>(t1 - t0).count();
+    res.packets_ = pkts.size();
+    res.tx_packets_ = sink->tx_packets_;
+    return res;
+}
+
+int main(int argc, char** argv)
+{
+    size_t iterations = 10;
+    bool json = false;
+    std::string path;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        if (a == "--iterations" && i + 1 < argc) iterations = std::stoul(argv[++i]);
+        else if (a == "--json") json = true;
+        else if (a[0] == '-')
+        {
+            usage();
+            return 1;
+        }
+        else path = a;
+    }
+    if (path.empty() || iterations == 0)
+    {
+        usage();
+        return 1;
+    }
+
+    std::vector<PcapPacket> pkts;
+    std::string err;
+    if (!readPcap(path, pkts, err))
+    {
+        std::cerr << "pcap_replay: " << err << std::endl;
+        return 1;
+    }
+
+    SocketAddr server, client;
+    std::vector<ReplayPacket> flow;
+    uint32_t cap_isn = 0;
+    if (!selectFlow(pkts, server, client, flow, cap_isn))
+    {
+        std::cerr << "pcap_replay: no TCP handshake in " << path << std::endl;
+        return 1;
+    }
+
+    ReplayResult total;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        auto r = replayOnce(flow, server, cap_isn);
+        total.seconds_ += r.seconds_;
+        total.packets_ += r.packets_;
+        total.allocs_ += r.allocs_;
+        total.alloc_bytes_ += r.alloc_bytes_;
+        total.delivered_ += r.delivered_;
+        total.tx_packets_ += r.tx_packets_;
+    }
+
+    double pps = total.packets_ / total.seconds_;
+    double ns_per_pkt = total.seconds_ * 1e9 / total.packets_;
+    double allocs_per_pkt = (double)total.allocs_ / total.packets_;
+    double bytes_per_iter = (double)total.delivered_ / iterations;
+    if (json)
+    {
+        std::cout << "{\"file\":\"" << path << "\",\"iterations\":" << iterations
+                  << ",\"packets\":" << flow.size()
+                  << ",\"pps\":" << pps
+                  << ",\"ns_per_pkt\":" << ns_per_pkt
+                  << ",\"allocs_per_pkt\":" << allocs_per_pkt
+                  << ",\"alloc_bytes_per_pkt\":" << (double)total.alloc_bytes_ / total.packets_
+                  << ",\"delivered_bytes\":" << bytes_per_iter
+                  << ",\"tx_packets\":" << total.tx_packets_ / iterations << "}" << std::endl;
+    }
+    else
+    {
+        std::cout << path << ": " << flow.size() << " packets x " << iterations << " iterations" << std::endl;
+        std::cout << "  " << pps << " packets/s, " << ns_per_pkt << " ns/packet" << std::endl;
+        std::cout << "  " << allocs_per_pkt << " allocs/packet ("
+                  << (double)total.alloc_bytes_ / total.packets_ << " bytes/packet)" << std::endl;
+        std::cout << "  " << bytes_per_iter << " bytes delivered, "
+                  << total.tx_packets_ / iterations << " packets transmitted per iteration" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Two-thread stress test for SPSCByteRing: a producer writes small chunks
+// while the consumer reads them back and calls trim() whenever the ring
+// looks empty, which is what the engine and an application thread do to a
+// socket's send and receive rings. Several rings share one BufferPool, so
+// a block that is detached while it still holds unread bytes soon carries
+// another ring's data and shows up as a pattern mismatch.
+//
+// Build (from the repository root):
+//   g++ -std=c++20 -O2 -Iinclude src/SPSCRing.cpp src/BufferPool.cpp
+//       tools/ring_stress.cpp -o ring_stress -pthread
+//
+// Usage: ring_stress [--rings N] [--duration SECONDS]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+
+#include <SPSCRing.hpp>
+#include <BufferPool.hpp>
+
+using namespace ustacktcp;
+
+namespace {
+
+constexpr size_t RING_SIZE = 4096;
+constexpr size_t CHUNK_MAX = 64;
+
+std::byte pattern(size_t ring, size_t pos)
+{
+    return std::byte((pos % 251) ^ (ring * 0x5b));
+}
+
+struct Lane {
+    SPSCByteRing ring_;
+    size_t id_;
+    size_t written_ = 0;
+    size_t read_ = 0;
+    size_t trims_ = 0;
+    size_t errors_ = 0;
+
+    Lane(size_t id, BufferPool& pool) : ring_(RING_SIZE, &pool), id_(id) {}
+};
+
+void produce(Lane& lane, const std::atomic<bool>& stop)
+{
+    std::byte chunk[CHUNK_MAX];
+    size_t n = 1;
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        for (size_t i = 0; i < n; i++) chunk[i] = pattern(lane.id_, lane.written_ + i);
+        size_t put = lane.ring_.write(chunk, n);
+        lane.written_ += put;
+        if (put == 0) std::this_thread::yield();
+        n = n % CHUNK_MAX + 1;
+    }
+}
+
+void consume(Lane& lane, const std::atomic<bool>& stop)
+{
+    std::byte chunk[CHUNK_MAX];
+    size_t n = CHUNK_MAX;
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        size_t got = lane.ring_.read(chunk, n);
+        for (size_t i = 0; i < got; i++)
+        {
+            if (chunk[i] != pattern(lane.id_, lane.read_ + i)) lane.errors_++;
+        }
+        lane.read_ += got;
+        if (lane.ring_.trim()) lane.trims_++;
+        if (got == 0) std::this_thread::yield();
+        n = n == 1 ? CHUNK_MAX : n - 1;
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t rings = 2;
+    double duration = 5;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--rings" && i + 1 < argc) rings = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--duration" && i + 1 < argc) duration = std::strtod(argv[++i], nullptr);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--rings N] [--duration SECONDS]" << std::endl;
+            return 2;
+        }
+    }
+
+    BufferPool pool(RING_SIZE, rings);
+    std::vector<std::unique_ptr<Lane>> lanes;
+    for (size_t i = 0; i < rings; i++) lanes.push_back(std::make_unique<Lane>(i, pool));
+
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> threads;
+    for (auto& lane : lanes)
+    {
+        threads.emplace_back(produce, std::ref(*lane), std::cref(stop));
+        threads.emplace_back(consume, std::ref(*lane), std::cref(stop));
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+    stop = true;
+    for (auto& t : threads) t.join();
+
+    size_t errors = 0;
+    for (auto& lane : lanes)
+    {
+        // whatever is still queued must read back intact as well
+        std::byte chunk[CHUNK_MAX];
+        while (size_t got = lane->ring_.read(chunk, CHUNK_MAX))
+        {
+            for (size_t i = 0; i < got; i++)
+            {
+                if (chunk[i] != pattern(lane->id_, lane->read_ + i)) lane->errors_++;
+            }
+            lane->read_ += got;
+        }
+        if (lane->read_ != lane->written_) lane->errors_++;
+        std::cout << "ring " << lane->id_ << ": " << lane->written_ << " bytes, "
+                  << lane->trims_ << " trims, " << lane->errors_ << " errors" << std::endl;
+        errors += lane->errors_;
+    }
+    std::cout << (errors ? "FAIL" : "OK") << std::endl;
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+// Engine scenarios, mostly in simulated time, each checked for a definite
+// outcome rather than measured. Prints one PASS/FAIL line per scenario;
+// the exit status is the number of failures.
+//
+// Build (from the repository root):
+//   g++ -std=c++20 -O2 -Iinclude $(ls src/*.cpp | grep -v main.cpp)
+//       tools/sim_check.cpp -o sim_check -pthread
+//
+// Usage: sim_check [--filter SUBSTR]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <Simulator.hpp>
+#include <StreamSocket.hpp>
+#include <BufferPool.hpp>
+
+using namespace ustacktcp;
+
+namespace {
+
+using namespace std::chrono_literals;
+
+struct Scenario {
+    const char* name_;
+    std::function<std::string()> run_;  // empty on success, else what went wrong
+};
+
+SocketAddr addr(const char* ip, uint16_t port)
+{
+    return SocketAddr(IPAddr(ntohl(inet_addr(ip))), port);
+}
+
+EngineOptions linkOptions()
+{
+    LinkEmulatorOptions link;
+    link.tx_.delay_ = 5ms;
+    link.tx_.rate_bps_ = 100000000;
+    link.tx_.queue_bytes_ = 256 * 1024;
+    EngineOptions o;
+    o.link_emulator_ = link;
+    o.port_lo_ = 1;
+    o.port_hi_ = 65535;
+    return o;
+}
+
+// client -> proxy (spliced) -> server, with the client on the server's
+// engine; the server aborts mid-transfer
+std::string spliceDstAbort()
+{
+    Simulator sim;
+    auto [e, p] = sim.addLink(linkOptions(), linkOptions());
+    auto server = make_socket(*e), client = make_socket(*e);
+    auto front = make_socket(*p), back = make_socket(*p);
+    server->bind(addr("10.0.0.1", 2000));
+    client->bind(addr("10.0.0.1", 3000));
+    front->bind(addr("10.0.0.2", 1000));
+    back->bind(addr("10.0.0.2", 1001));
+    server->listenAsync();
+    front->listenAsync();
+    client->connectAsync(addr("10.0.0.2", 1000));
+    back->connectAsync(addr("10.0.0.1", 2000));
+    auto up = [](const std::shared_ptr<StreamSocket>& s) { return s->_state == SocketState::ESTABLISHED; };
+    if (!sim.runFor(5s, [&]() { return up(server) && up(client) && up(front) && up(back); })) return "handshakes did not complete";
+    if (!splice(front, back)) return "splice failed";
+
+    std::byte chunk[16384] = {};
+    std::byte buf[65536];
+    size_t received = 0;
+    bool client_closed = false;
+    auto transfer = [&]() {
+        ssize_t n;
+        while ((n = client->trySend(chunk, sizeof(chunk))) > 0) {}
+        client_closed = n < 0;
+        while ((n = server->tryRecv(buf, sizeof(buf))) > 0) received += n;
+    };
+    sim.runFor(10s, [&]() { transfer(); return received >= 1000000; });
+    if (received < 1000000) return "relay stalled before the abort";
+
+    // the server stops reading, so the relay backs up into the source's ring
+    sim.runFor(200ms, [&]() { ssize_t n; while ((n = client->trySend(chunk, sizeof(chunk))) > 0) {} return false; });
+    server->abort();
+    auto closed = [](const std::shared_ptr<StreamSocket>& s) { return s->_state == SocketState::CLOSED; };
+    sim.runFor(5s, [&]() { transfer(); return client_closed && closed(front) && closed(back); });
+    if (!closed(back)) return "destination not closed by the RST";
+    if (!closed(front)) return "source not aborted";
+    if (!client_closed) return "client never saw the abort";
+    if (p->bufferPool().live() != 0) return "proxy still holds " + std::to_string(p->bufferPool().live()) + " buffers";
+    return "";
+}
+
+// A client and a server on either end of one link, connected
+struct Pair {
+    Simulator sim_;
+    std::shared_ptr<StreamSocket> server_, client_;
+
+    std::string connect(EngineOptions os = linkOptions(), EngineOptions oc = linkOptions())
+    {
+        auto [se, ce] = sim_.addLink(os, oc);
+        server_ = make_socket(*se);
+        client_ = make_socket(*ce);
+        server_->bind(addr("10.0.0.1", 2000));
+        client_->bind(addr("10.0.0.2", 3000));
+        server_->listenAsync();
+        client_->connectAsync(addr("10.0.0.1", 2000));
+        bool up = sim_.runFor(5s, [&]() {
+            return server_->_state == SocketState::ESTABLISHED && client_->_state == SocketState::ESTABLISHED;
+        });
+        return up ? "" : "handshake did not complete";
+    }
+};
+
+// a file whose window cannot be mapped (the descriptor is write-only)
+// must fail the connection, not leave it retrying with a FIN stuck
+// behind the file
+std::string sendFileMapFail()
+{
+    Pair p;
+    std::string err = p.connect();
+    if (!err.empty()) return err;
+    char path[] = "/tmp/sim_check_fileXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return "mkstemp failed";
+    std::vector<char> body(256 * 1024, 'x');
+    bool written = write(fd, body.data(), body.size()) == (ssize_t)body.size();
+    ::close(fd);
+    int wfd = written ? open(path, O_WRONLY) : -1;
+    unlink(path);
+    if (wfd < 0) return "could not set up the file";
+    ssize_t queued = p.client_->sendFile(wfd, 0, body.size());
+    ::close(wfd);
+    if (queued != (ssize_t)body.size()) return "sendFile refused the file";
+    std::byte tail[100] = {};
+    p.client_->trySend(tail, sizeof(tail));
+    p.client_->close();
+    std::byte buf[65536];
+    bool closed = p.sim_.runFor(5s, [&]() {
+        while (p.server_->tryRecv(buf, sizeof(buf)) > 0) {}
+        return p.client_->_state == SocketState::CLOSED && p.server_->_state == SocketState::CLOSED;
+    });
+    if (!closed) return "connection still open";
+    if (p.client_->trySend(tail, sizeof(tail)) >= 0) return "send after the failure was accepted";
+    return "";
+}
+
+// The reader keeps its window under one MSS by taking a few hundred
+// bytes only once the window is nearly shut; the sender must still get
+// everything through (RFC 1122 4.2.3.4) instead of waiting for a full MSS
+std::string subMssWindow()
+{
+    Pair p;
+    std::string err = p.connect();
+    if (!err.empty()) return err;
+    const size_t total = SOCKET_BUFFER_SIZE + 16 * 1024;
+    std::byte chunk[16384] = {};
+    std::byte buf[500];
+    size_t sent = 0, received = 0;
+    bool done = p.sim_.runFor(120s, [&]() {
+        while (sent < total)
+        {
+            ssize_t n = p.client_->trySend(chunk, std::min(sizeof(chunk), total - sent));
+            if (n <= 0) break;
+            sent += n;
+        }
+        if (p.server_->getInfo().rcv_wnd_ < sizeof(buf))
+        {
+            ssize_t n = p.server_->tryRecv(buf, sizeof(buf));
+            if (n > 0) received += n;
+        }
+        return received + SOCKET_BUFFER_SIZE - p.server_->getInfo().rcv_wnd_ >= total;
+    });
+    return done ? "" : "stalled after " + std::to_string(received) + " bytes read";
+}
+
+// engines exporting metrics are created and dropped in a row; the export
+// thread must be gone with its engine
+std::string exporterTeardown()
+{
+    std::string path = "/tmp/sim_check_metrics." + std::to_string(getpid());
+    for (int i = 0; i < 20; i++)
+    {
+        EngineOptions o = linkOptions();
+        o.metrics_export_.path_ = path;
+        o.metrics_export_.interval_ = std::chrono::milliseconds(1);
+        Simulator sim;
+        sim.addLink(o, o);
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    bool exported = access(path.c_str(), F_OK) == 0;
+    remove(path.c_str());
+    return exported ? "" : "nothing was exported";
+}
+
+const std::vector<Scenario> SCENARIOS = {
+    {"splice_dst_abort", spliceDstAbort},
+    {"exporter_teardown", exporterTeardown},
+    {"sendfile_map_fail", sendFileMapFail},
+    {"sub_mss_window", subMssWindow},
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string filter;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        if (a == "--filter" && i + 1 < argc) filter = argv[++i];
+        else
+        {
+            std::cerr << "usage: sim_check [--filter SUBSTR]" << std::endl;
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (const Scenario& s : SCENARIOS)
+    {
+        if (!filter.empty() && std::string(s.name_).find(filter) == std::string::npos) continue;
+        std::string err = s.run_();
+        std::cout << (err.empty() ? "PASS " : "FAIL ") << s.name_;
+        if (!err.empty()) std::cout << ": " << err;
+        std::cout << std::endl;
+        failed += !err.empty();
+    }
+    return failed;
+}
@@ -0,0 +1,578 @@
+// iperf/netperf-style benchmark suite for the stack.
+//
+// A server and a client engine run in run-to-completion mode on their own
+// threads, joined by an in-process PipeDevice link, so the numbers cover
+// the TCP implementation and nothing below it. Tests:
+//   bulk   streaming throughput over --flows connections (also run with 1).
+//          Run again sending a 64MB file with sendFile(), kept two deep
+//   rr     TCP_RR: --size byte request/response, latency percentiles
+//   crr    TCP_CRR: connect, one transaction, close; connections/s. With
+//          --ports N the client cycles through N ports, reusing tuples
+//          still in TIME_WAIT once they are old enough. Run again with
+//          TCP Fast Open, the request riding on the SYN
+//   idle   open --connections connections, one byte each way, then idle;
+//          memory per connection once the buffers are back in the pool
+//   relay  a proxy on the server engine passes a bulk stream from one
+//          connection to another: once through an application thread
+//          (recv, then send), once with splice()
+// Results are printed as one JSON object on stdout.
+//
+// Build (from the repository root):
+//   g++ -std=c++20 -O2 -Iinclude -Itools $(ls src/*.cpp | grep -v main.cpp)
+//       tools/AllocCounter.cpp tools/ustack_bench.cpp -o ustack_bench -pthread
+//
+// Usage: ustack_bench [--test bulk|rr|crr|idle|relay|all] [--duration S] [--flows N]
+//                     [--size B] [--connections N] [--ports N]
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdlib>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <TCPEngine.hpp>
+#include <StreamSocket.hpp>
+#include <NetDevice.hpp>
+#include <Metrics.hpp>
+#include <AllocCounter.hpp>
+
+using namespace ustacktcp;
+
+namespace {
+
+using SteadyClock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string test_ = "all";
+    double duration_ = 3;
+    size_t flows_ = 4;
+    size_t size_ = 1;
+    size_t connections_ = 1000;
+    size_t ports_ = 0;  // crr: 0 moves to a fresh tuple per connection
+};
+
+bool waitFor(const std::function<bool()>& pred, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+{
+    const auto deadline = SteadyClock::now() + timeout;
+    while (!pred())
+    {
+        if (SteadyClock::now() > deadline) return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+long rssBytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Server and client engine on their own loop threads over an in-memory link
+class BenchPair {
+    private:
+        std::unique_ptr<TCPEngine> server_;
+        std::unique_ptr<TCPEngine> client_;
+        std::thread server_thread_;
+        std::thread client_thread_;
+        uint32_t server_ip_ = ntohl(inet_addr("10.0.0.1"));
+        uint32_t client_ip_ = ntohl(inet_addr("10.0.0.2"));
+        uint16_t next_port_ = 1024;
+        uint16_t port_end_ = 65535;
+        bool wrap_ = false;  // reuse ports instead of moving to new addresses
+
+    public:
+        explicit BenchPair(size_t ports = 0)
+        {
+            if (ports > 0)
+            {
+                port_end_ = std::min<size_t>(65535, 1024 + ports);
+                wrap_ = true;
+            }
+            auto [ds, dc] = PipeDevice::makePair();
+            EngineOptions opts;
+            opts.mode_ = EngineMode::RUN_TO_COMPLETION;
+            opts.port_lo_ = 1;
+            opts.port_hi_ = 65535;
+            opts.fast_open_ = true;
+            opts.device_ = ds;
+            server_ = std::make_unique<TCPEngine>(opts);
+            opts.device_ = dc;
+            client_ = std::make_unique<TCPEngine>(opts);
+            server_thread_ = std::thread(&TCPEngine::run, server_.get());
+            client_thread_ = std::thread(&TCPEngine::run, client_.get());
+            waitFor([this]() { return server_->running() && client_->running(); });
+        }
+
+        ~BenchPair()
+        {
+            server_->stop();
+            client_->stop();
+            server_thread_.join();
+            client_thread_.join();
+        }
+
+        // a listening server and an unconnected client on a fresh port pair
+        bool prepare(std::shared_ptr<StreamSocket>& srv, std::shared_ptr<StreamSocket>& cli, SocketAddr& srv_addr)
+        {
+            if (next_port_ == port_end_)
+            {
+                // sockets are demultiplexed by local address only; move both
+                // ends to fresh addresses to go past 64K connections
+                next_port_ = 1024;
+                if (!wrap_)
+                {
+                    server_ip_ += 2;
+                    client_ip_ += 2;
+                }
+            }
+            uint16_t port = next_port_++;
+            srv = make_socket(*server_);
+            cli = make_socket(*client_);
+            srv_addr = SocketAddr(IPAddr(server_ip_), port);
+            if (!srv->bind(srv_addr) || !cli->bind(SocketAddr(IPAddr(client_ip_), port))) return false;
+            srv->listenAsync();
+            return waitFor([&]() { return srv->_state == SocketState::LISTEN; });
+        }
+
+        // one established connection on a fresh port pair
+        bool open(std::shared_ptr<StreamSocket>& srv, std::shared_ptr<StreamSocket>& cli)
+        {
+            SocketAddr srv_addr;
+            if (!prepare(srv, cli, srv_addr)) return false;
+            cli->connectAsync(srv_addr);
+            return waitFor([&]() {
+                return srv->_state == SocketState::ESTABLISHED && cli->_state == SocketState::ESTABLISHED;
+            });
+        }
+
+        // connecting with Fast Open, the request queued to go with the SYN;
+        // returns at once
+        bool openFastOpen(std::shared_ptr<StreamSocket>& srv, std::shared_ptr<StreamSocket>& cli, const std::byte* req, size_t len)
+        {
+            SocketAddr srv_addr;
+            if (!prepare(srv, cli, srv_addr)) return false;
+            return cli->connectFastOpenAsync(srv_addr, req, len) == (ssize_t)len;
+        }
+
+        TCPEngine& server() { return *server_; }
+        TCPEngine& client() { return *client_; }
+};
+
+// writes all of buf, spinning while the send ring is full
+bool sendAll(StreamSocket& s, const std::byte* buf, size_t len, SteadyClock::time_point deadline)
+{
+    while (len > 0)
+    {
+        ssize_t n = s.trySend(buf, len);
+        if (n < 0) return false;
+        buf += n;
+        len -= n;
+        if (n == 0)
+        {
+            if (SteadyClock::now() > deadline) return false;
+            std::this_thread::yield();
+        }
+    }
+    return true;
+}
+
+bool recvAll(StreamSocket& s, std::byte* buf, size_t len, SteadyClock::time_point deadline)
+{
+    while (len > 0)
+    {
+        ssize_t n = s.tryRecv(buf, len);
+        if (n < 0) return false;
+        buf += n;
+        len -= n;
+        if (n == 0)
+        {
+            if (SteadyClock::now() > deadline) return false;
+            std::this_thread::yield();
+        }
+    }
+    return true;
+}
+
+// an unlinked scratch file of len zero bytes, -1 on failure
+int scratchFile(size_t len)
+{
+    char path[] = "/tmp/ustack_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (ftruncate(fd, len) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+std::string bulk(const BenchOptions& opts, size_t flows, bool from_file)
+{
+    BenchPair pair;
+    std::vector<std::shared_ptr<StreamSocket>> srv(flows), cli(flows);
+    for (size_t i = 0; i < flows; i++)
+    {
+        if (!pair.open(srv[i], cli[i])) return "{\"error\":\"connect failed\"}";
+    }
+
+    constexpr size_t FILE_SIZE = 64 * 1024 * 1024;
+    const int fd = from_file ? scratchFile(FILE_SIZE) : -1;
+    if (from_file && fd < 0) return "{\"error\":\"no scratch file\"}";
+    const long rss_before = rssBytes();
+
+    std::vector<std::atomic<uint64_t>> received(flows);
+    std::atomic<bool> done = false;
+    std::thread sender([&]() {
+        std::byte chunk[65536] = {};
+        std::vector<uint64_t> queued(flows, 0);
+        while (!done.load(std::memory_order_relaxed))
+        {
+            bool progress = false;
+            for (size_t i = 0; i < flows; i++)
+            {
+                if (!from_file)
+                {
+                    progress |= cli[i]->trySend(chunk, sizeof(chunk)) > 0;
+                }
+                else if (queued[i] - received[i].load(std::memory_order_relaxed) < 2 * FILE_SIZE)
+                {
+                    queued[i] += FILE_SIZE;
+                    progress |= cli[i]->sendFile(fd, 0, FILE_SIZE) > 0;
+                }
+            }
+            if (!progress) std::this_thread::yield();
+        }
+    });
+
+    std::byte buf[65536];
+    const auto t0 = SteadyClock::now();
+    const auto end = t0 + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(opts.duration_));
+    while (SteadyClock::now() < end)
+    {
+        bool progress = false;
+        for (size_t i = 0; i < flows; i++)
+        {
+            ssize_t n;
+            while ((n = srv[i]->tryRecv(buf, sizeof(buf))) > 0)
+            {
+                received[i].fetch_add(n, std::memory_order_relaxed);
+                progress = true;
+            }
+        }
+        if (!progress) std::this_thread::yield();
+    }
+    const double secs = std::chrono::duration<double>(SteadyClock::now() - t0).count();
+    const long rss_growth = rssBytes() - rss_before;
+    done = true;
+    sender.join();
+
+    uint64_t total = 0, retrans = 0;
+    std::ostringstream per_flow;
+    for (size_t i = 0; i < flows; i++)
+    {
+        total += received[i];
+        retrans += cli[i]->getInfo().total_retrans_;
+        per_flow << (i ? "," : "") << received[i] * 8 / secs / 1e9;
+    }
+    std::ostringstream out;
+    out << "{\"flows\":" << flows << ",\"seconds\":" << secs << ",\"bytes\":" << total
+        << ",\"gbit_per_s\":" << total * 8 / secs / 1e9
+        << ",\"per_flow_gbit_per_s\":[" << per_flow.str() << "]"
+        << ",\"retransmits\":" << retrans;
+    if (from_file)
+    {
+        // mappings are unmapped as they are acked: growth stays at a few
+        // windows however many files went through
+        out << ",\"rss_growth_bytes\":" << rss_growth;
+        close(fd);
+    }
+    out << "}";
+    return out.str();
+}
+
+std::string relay(const BenchOptions& opts, bool spliced)
+{
+    // the proxy holds the server end of both: data in on one, out on the other
+    BenchPair pair;
+    std::shared_ptr<StreamSocket> in_srv, in_cli, out_srv, out_cli;
+    if (!pair.open(in_srv, in_cli) || !pair.open(out_srv, out_cli)) return "{\"error\":\"connect failed\"}";
+    if (spliced && !splice(in_srv, out_srv)) return "{\"error\":\"splice failed\"}";
+
+    std::atomic<bool> done = false;
+    std::thread sender([&]() {
+        std::byte chunk[65536] = {};
+        while (!done.load(std::memory_order_relaxed))
+        {
+            if (in_cli->trySend(chunk, sizeof(chunk)) <= 0) std::this_thread::yield();
+        }
+    });
+    std::thread proxy;
+    if (!spliced)
+    {
+        proxy = std::thread([&]() {
+            std::byte buf[65536];
+            while (!done.load(std::memory_order_relaxed))
+            {
+                ssize_t n = in_srv->tryRecv(buf, sizeof(buf));
+                if (n <= 0 || !sendAll(*out_srv, buf, n, SteadyClock::now() + std::chrono::seconds(5))) std::this_thread::yield();
+            }
+        });
+    }
+
+    std::byte buf[65536];
+    uint64_t received = 0;
+    const auto t0 = SteadyClock::now();
+    const auto end = t0 + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(opts.duration_));
+    while (SteadyClock::now() < end)
+    {
+        ssize_t n = out_cli->tryRecv(buf, sizeof(buf));
+        if (n > 0) received += n;
+        else std::this_thread::yield();
+    }
+    const double secs = std::chrono::duration<double>(SteadyClock::now() - t0).count();
+    done = true;
+    sender.join();
+    if (proxy.joinable()) proxy.join();
+
+    std::ostringstream out;
+    out << "{\"seconds\":" << secs << ",\"bytes\":" << received
+        << ",\"gbit_per_s\":" << received * 8 / secs / 1e9
+        << ",\"retransmits\":" << out_srv->getInfo().total_retrans_ << "}";
+    return out.str();
+}
+
+std::string percentiles(const LatencyHistogram& h)
+{
+    std::ostringstream out;
+    out << "\"transactions\":" << h.count()
+        << ",\"mean_us\":" << (h.count() ? h.sum() / 1e3 / h.count() : 0)
+        << ",\"p50_us\":" << h.percentile(50) / 1e3
+        << ",\"p99_us\":" << h.percentile(99) / 1e3
+        << ",\"p999_us\":" << h.percentile(99.9) / 1e3
+        << ",\"max_us\":" << h.max() / 1e3;
+    return out.str();
+}
+
+std::string requestResponse(const BenchOptions& opts)
+{
+    BenchPair pair;
+    std::shared_ptr<StreamSocket> srv, cli;
+    if (!pair.open(srv, cli)) return "{\"error\":\"connect failed\"}";
+
+    std::atomic<bool> done = false;
+    std::thread responder([&]() {
+        std::vector<std::byte> req(opts.size_);
+        while (!done.load(std::memory_order_relaxed))
+        {
+            auto deadline = SteadyClock::now() + std::chrono::milliseconds(100);
+            if (recvAll(*srv, req.data(), req.size(), deadline)) sendAll(*srv, req.data(), req.size(), deadline + std::chrono::seconds(5));
+        }
+    });
+
+    auto hist = std::make_unique<LatencyHistogram>();
+    std::vector<std::byte> req(opts.size_), resp(opts.size_);
+    const auto t0 = SteadyClock::now();
+    const auto end = t0 + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(opts.duration_));
+    bool ok = true;
+    while (ok && SteadyClock::now() < end)
+    {
+        const auto start = SteadyClock::now();
+        const auto deadline = start + std::chrono::seconds(5);
+        ok = sendAll(*cli, req.data(), req.size(), deadline) && recvAll(*cli, resp.data(), resp.size(), deadline);
+        if (ok) hist->record(SteadyClock::now() - start);
+    }
+    const double secs = std::chrono::duration<double>(SteadyClock::now() - t0).count();
+    done = true;
+    responder.join();
+
+    std::ostringstream out;
+    out << "{\"size\":" << opts.size_ << ",\"seconds\":" << secs
+        << ",\"transactions_per_s\":" << hist->count() / secs << "," << percentiles(*hist);
+    if (!ok) out << ",\"error\":\"transaction timed out\"";
+    out << "}";
+    return out.str();
+}
+
+std::string connectRequestResponse(const BenchOptions& opts, bool fast_open)
+{
+    BenchPair pair(opts.ports_);
+    auto hist = std::make_unique<LatencyHistogram>();
+    std::byte b{1};
+    const auto t0 = SteadyClock::now();
+    const auto end = t0 + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(opts.duration_));
+    std::string error;
+    while (SteadyClock::now() < end)
+    {
+        const auto start = SteadyClock::now();
+        const auto deadline = start + std::chrono::seconds(5);
+        std::shared_ptr<StreamSocket> srv, cli;
+        // with Fast Open the request goes with the SYN once the first
+        // connection has fetched a cookie
+        if (fast_open ? !pair.openFastOpen(srv, cli, &b, 1) : !pair.open(srv, cli))
+        {
+            error = "connect failed";
+            break;
+        }
+        if ((!fast_open && !sendAll(*cli, &b, 1, deadline)) || !recvAll(*srv, &b, 1, deadline) ||
+            !sendAll(*srv, &b, 1, deadline) || !recvAll(*cli, &b, 1, deadline))
+        {
+            error = "transaction timed out";
+            break;
+        }
+        if (!waitFor([&]() { return srv->_state == SocketState::ESTABLISHED; }))
+        {
+            error = "connect failed";
+            break;
+        }
+        cli->close();
+        if (!waitFor([&]() { return srv->_state == SocketState::CLOSE_WAIT; }))
+        {
+            error = "close timed out";
+            break;
+        }
+        srv->close();
+        if (!waitFor([&]() { return cli->_state == SocketState::TIME_WAIT || cli->_state == SocketState::CLOSED; }))
+        {
+            error = "close timed out";
+            break;
+        }
+        hist->record(SteadyClock::now() - start);
+    }
+    const double secs = std::chrono::duration<double>(SteadyClock::now() - t0).count();
+    std::ostringstream out;
+    out << "{\"seconds\":" << secs << ",\"connections_per_s\":" << hist->count() / secs << "," << percentiles(*hist)
+        << ",\"time_wait\":" << pair.client().timeWaitCount()
+        << ",\"time_wait_reuses\":" << pair.client().metrics().time_wait_reuses_.get();
+    if (fast_open)
+    {
+        out << ",\"fast_open_accepted\":" << pair.server().metrics().fast_open_accepted_.get()
+            << ",\"fast_open_fallbacks\":" << pair.client().metrics().fast_open_fallbacks_.get();
+    }
+    if (!error.empty()) out << ",\"error\":\"" << error << "\"";
+    out << "}";
+    return out.str();
+}
+
+std::string idleConnections(const BenchOptions& opts)
+{
+    BenchPair pair;
+    std::vector<std::shared_ptr<StreamSocket>> socks;
+    socks.reserve(opts.connections_ * 2);
+    const long rss0 = rssBytes();
+    const int64_t live0 = liveBytes();
+    size_t opened = 0;
+    std::string error;
+    for (; opened < opts.connections_; opened++)
+    {
+        std::shared_ptr<StreamSocket> srv, cli;
+        if (!pair.open(srv, cli))
+        {
+            error = "connect failed";
+            break;
+        }
+        // one byte each way, so both rings were attached once
+        std::byte b{1};
+        const auto deadline = SteadyClock::now() + std::chrono::seconds(5);
+        if (!sendAll(*cli, &b, 1, deadline) || !recvAll(*srv, &b, 1, deadline) ||
+            !sendAll(*srv, &b, 1, deadline) || !recvAll(*cli, &b, 1, deadline))
+        {
+            error = "transaction timed out";
+            break;
+        }
+        socks.push_back(srv);
+        socks.push_back(cli);
+    }
+    // drained buffers go back once the last ACKs are in
+    auto attached = [&]() { return pair.server().bufferPool().live() + pair.client().bufferPool().live(); };
+    waitFor([&]() { return attached() == 0; });
+    const long rss1 = rssBytes();
+    const int64_t live1 = liveBytes();
+    std::ostringstream out;
+    out << "{\"connections\":" << opened
+        << ",\"rss_bytes\":" << rss1 - rss0
+        << ",\"heap_bytes\":" << live1 - live0
+        << ",\"buffers_attached\":" << attached();
+    if (opened > 0)
+    {
+        // both endpoints live in this process
+        out << ",\"rss_bytes_per_endpoint\":" << (rss1 - rss0) / (2.0 * opened)
+            << ",\"heap_bytes_per_endpoint\":" << (live1 - live0) / (2.0 * opened);
+    }
+    if (!error.empty()) out << ",\"error\":\"" << error << "\"";
+    out << "}";
+    return out.str();
+}
+
+void usage()
+{
+    std::cerr << "usage: ustack_bench [--test bulk|rr|crr|idle|relay|all] [--duration S] [--flows N] [--size B] [--connections N] [--ports N]" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if (a == "--test" && has_val) opts.test_ = argv[++i];
+        else if (a == "--duration" && has_val) opts.duration_ = std::stod(argv[++i]);
+        else if (a == "--flows" && has_val) opts.flows_ = std::stoul(argv[++i]);
+        else if (a == "--size" && has_val) opts.size_ = std::stoul(argv[++i]);
+        else if (a == "--connections" && has_val) opts.connections_ = std::stoul(argv[++i]);
+        else if (a == "--ports" && has_val) opts.ports_ = std::stoul(argv[++i]);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (opts.flows_ == 0 || opts.size_ == 0 || opts.duration_ <= 0)
+    {
+        usage();
+        return 1;
+    }
+    bool all = opts.test_ == "all";
+    if (!all && opts.test_ != "bulk" && opts.test_ != "rr" && opts.test_ != "crr" && opts.test_ != "idle" && opts.test_ != "relay")
+    {
+        usage();
+        return 1;
+    }
+
+    std::ostringstream out;
+    out << "{\"duration\":" << opts.duration_;
+    if (all || opts.test_ == "bulk")
+    {
+        out << ",\"bulk_1\":" << bulk(opts, 1, false);
+        if (opts.flows_ > 1) out << ",\"bulk_" << opts.flows_ << "\":" << bulk(opts, opts.flows_, false);
+        out << ",\"bulk_sendfile_1\":" << bulk(opts, 1, true);
+    }
+    if (all || opts.test_ == "rr") out << ",\"tcp_rr\":" << requestResponse(opts);
+    if (all || opts.test_ == "crr")
+    {
+        out << ",\"tcp_crr\":" << connectRequestResponse(opts, false);
+        out << ",\"tcp_crr_fastopen\":" << connectRequestResponse(opts, true);
+    }
+    if (all || opts.test_ == "idle") out << ",\"idle\":" << idleConnections(opts);
+    if (all || opts.test_ == "relay")
+    {
+        out << ",\"relay_copy\":" << relay(opts, false);
+        out << ",\"relay_splice\":" << relay(opts, true);
+    }
+    out << "}";
+    std::cout << out.str() << std::endl;
+    return 0;
+}
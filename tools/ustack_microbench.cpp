@@ -0,0 +1,463 @@
+// Microbenchmarks for the stack's hot primitives, each run in isolation:
+// checksum, header codecs, RX coalescing, RecvBuffer and SendBuffer operations. Every case
+// reports ns/op, bytes/s (for cases that move payload) and allocations/op.
+//
+// SendBuffer cases transmit through TCPEngine::send to a null device, so
+// they include header assembly and checksumming of each segment;
+// engine/send times that step alone.
+//
+// Build (from the repository root):
+//   g++ -std=c++20 -O2 -Iinclude -Itools $(ls src/*.cpp | grep -v main.cpp)
+//       tools/AllocCounter.cpp tools/ustack_microbench.cpp -o ustack_microbench -pthread
+//
+// Usage: ustack_microbench [--filter SUBSTR] [--min-time SECONDS] [--json]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <arpa/inet.h>
+
+#include <types.hpp>
+#include <TCPEngine.hpp>
+#include <RecvBuffer.hpp>
+#include <SendBuffer.hpp>
+#include <NetDevice.hpp>
+#include <SegmentCoalescer.hpp>
+#include <AllocCounter.hpp>
+
+using namespace ustacktcp;
+
+namespace {
+
+using SteadyClock = std::chrono::steady_clock;
+
+template <typename T>
+inline void doNotOptimize(T& v)
+{
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+class NullDevice : public NetDevice {
+    public:
+        ssize_t transmit(const std::byte*, size_t len) override { return len; }
+
+        ssize_t receive(std::byte*, size_t, bool) override
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        int pollFd() const override { return -1; }
+};
+
+struct Result {
+    std::string name_;
+    uint64_t ops_;
+    double ns_per_op_;
+    double bytes_per_s_;    // 0 when the case moves no payload
+    double allocs_per_op_;
+};
+
+struct Options {
+    std::string filter_;
+    double min_time_ = 0.2;
+    bool json_ = false;
+};
+
+// op(n) performs n operations; the batch doubles until min_time_ is reached
+Result measure(const Options& opts, const std::string& name, size_t bytes_per_op, const std::function<void(uint64_t)>& op)
+{
+    op(16); // warm caches and lazily-built state
+    uint64_t n = 64;
+    while (true)
+    {
+        uint64_t a0 = allocCount();
+        auto t0 = SteadyClock::now();
+        op(n);
+        double secs = std::chrono::duration<double>(SteadyClock::now() - t0).count();
+        uint64_t allocs = allocCount() - a0;
+        if (secs >= opts.min_time_ || n >= (1ull << 34))
+        {
+            return {name, n, secs * 1e9 / n, bytes_per_op ? bytes_per_op * n / secs : 0, (double)allocs / n};
+        }
+        n *= secs > 0 ? std::min<uint64_t>(100, std::max<uint64_t>(2, (uint64_t)(opts.min_time_ * 1.2 / secs))) : 100;
+    }
+}
+
+std::unique_ptr<TCPEngine> nullEngine()
+{
+    EngineOptions eo;
+    eo.mode_ = EngineMode::RUN_TO_COMPLETION;
+    eo.device_ = std::make_shared<NullDevice>();
+    return std::make_unique<TCPEngine>(eo);
+}
+
+void checksumCases(const Options& opts, std::vector<Result>& out, const std::function<bool(const std::string&)>& want)
+{
+    std::vector<std::byte> buf(65536);
+    for (size_t i = 0; i < buf.size(); i++) buf[i] = std::byte(i * 131);
+    for (size_t sz : {20, 64, 512, 1460, 9000, 65535})
+    {
+        std::string name = "checksum/add/" + std::to_string(sz);
+        if (!want(name)) continue;
+        out.push_back(measure(opts, name, sz, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                InternetChecksumBuilder c;
+                c.add(buf.data(), sz);
+                uint16_t s = c.finalize();
+                doNotOptimize(s);
+            }
+        }));
+    }
+}
+
+void headerCases(const Options& opts, std::vector<Result>& out, const std::function<bool(const std::string&)>& want)
+{
+    std::byte wire[60] = {};
+    TCPHeader h;
+    h.src_port = 40000;
+    h.dst_port = 40001;
+    h.seq_num = 123456789;
+    h.ack_num = 987654321;
+    h.data_offset = 5 << 4;
+    h.flags = TCPFlag::ACK | TCPFlag::PSH;
+    h.window_size = 65535;
+    h.checksum = 0;
+    h.urgent_pointer = 0;
+    h.writeNetworkBytes(wire);
+
+    if (want("tcpheader/parse"))
+    {
+        out.push_back(measure(opts, "tcpheader/parse", 0, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                doNotOptimize(wire);
+                TCPHeader p(wire);
+                doNotOptimize(p);
+            }
+        }));
+    }
+    if (want("tcpheader/write"))
+    {
+        out.push_back(measure(opts, "tcpheader/write", 0, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                doNotOptimize(h);
+                h.writeNetworkBytes(wire);
+                doNotOptimize(wire);
+            }
+        }));
+    }
+
+    std::byte ip[20] = {std::byte{0x45}};
+    ip[9] = std::byte{IPPROTO_TCP};
+    if (want("ipheader/parse"))
+    {
+        out.push_back(measure(opts, "ipheader/parse", 0, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                doNotOptimize(ip);
+                IPHeader p(ip);
+                doNotOptimize(p);
+            }
+        }));
+    }
+}
+
+// a 32-packet RX batch of one flow merged into one segment and handed on
+void coalescerCases(const Options& opts, std::vector<Result>& out, const std::function<bool(const std::string&)>& want)
+{
+    constexpr size_t MSS = 1460;
+    constexpr size_t BATCH = 32;
+    if (!want("gro/add/1460")) return;
+
+    // one batch of consecutive segments, prebuilt
+    std::vector<std::vector<std::byte>> pkts(BATCH, std::vector<std::byte>(PacketTemplate::SIZE + MSS, std::byte{0x5a}));
+    PacketTemplate tmpl;
+    tmpl.build(SocketAddr(IPAddr(ntohl(inet_addr("10.0.0.2"))), 40001), SocketAddr(IPAddr(ntohl(inet_addr("10.0.0.1"))), 40000), 0, true);
+    for (size_t k = 0; k < BATCH; k++)
+    {
+        memcpy(pkts[k].data(), tmpl.hdr_, PacketTemplate::SIZE);
+        tmpl.finish(pkts[k].data(), pkts[k].size(), 0, 1000 + k * MSS, 1000, TCPFlag::PSH | TCPFlag::ACK, 65535);
+    }
+    SegmentCoalescer gro;
+    out.push_back(measure(opts, "gro/add/1460", MSS, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+        {
+            gro.add(pkts[i % BATCH].data(), pkts[i % BATCH].size());
+            if (i % BATCH == BATCH - 1)
+            {
+                doNotOptimize(gro);
+                gro.clear();
+            }
+        }
+    }));
+}
+
+void recvBufferCases(const Options& opts, std::vector<Result>& out, const std::function<bool(const std::string&)>& want)
+{
+    constexpr size_t MSS = 1460;
+    std::vector<std::byte> payload(65536, std::byte{0x5a});
+    std::vector<std::byte> sink(65536);
+    // drained rings hand their block back, as they do inside the engine
+    BufferPool pool(SOCKET_BUFFER_SIZE, 4);
+
+    if (want("recvbuffer/enqueue/in-order"))
+    {
+        auto rb = std::make_unique<RecvBuffer>(&pool);
+        uint32_t seq = 1000;
+        rb->setIRS(seq);
+        out.push_back(measure(opts, "recvbuffer/enqueue/in-order", MSS, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                rb->enqueue(payload.data(), MSS, seq, TCPFlag::ACK);
+                seq += MSS;
+                if (rb->getWindowSize() < MSS) rb->dequeue(sink.data(), sink.size());
+            }
+        }));
+    }
+
+    // a window of 32 segments delivered back to front, so every segment but
+    // the last lands out of order and the last one completes the range
+    constexpr size_t BATCH = 32;
+    if (want("recvbuffer/enqueue/out-of-order"))
+    {
+        auto rb = std::make_unique<RecvBuffer>(&pool);
+        uint32_t seq = 1000;
+        rb->setIRS(seq);
+        out.push_back(measure(opts, "recvbuffer/enqueue/out-of-order", MSS, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i += BATCH)
+            {
+                for (size_t k = BATCH; k-- > 0;) rb->enqueue(payload.data(), MSS, seq + k * MSS, TCPFlag::ACK);
+                seq += BATCH * MSS;
+                rb->dequeue(sink.data(), sink.size());
+            }
+        }));
+    }
+
+    // same, but each segment also repeats the second half of its predecessor
+    if (want("recvbuffer/enqueue/overlap"))
+    {
+        auto rb = std::make_unique<RecvBuffer>(&pool);
+        uint32_t seq = 1000;
+        rb->setIRS(seq);
+        out.push_back(measure(opts, "recvbuffer/enqueue/overlap", MSS, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i += BATCH)
+            {
+                for (size_t k = BATCH; k-- > 0;)
+                {
+                    uint32_t s = seq + k * MSS;
+                    size_t len = MSS;
+                    if (k > 0)
+                    {
+                        s -= MSS / 2;
+                        len += MSS / 2;
+                    }
+                    rb->enqueue(payload.data(), len, s, TCPFlag::ACK);
+                }
+                seq += BATCH * MSS;
+                rb->dequeue(sink.data(), sink.size());
+            }
+        }));
+    }
+
+    for (size_t chunk : {size_t(1460), size_t(16384)})
+    {
+        std::string name = "recvbuffer/dequeue/" + std::to_string(chunk);
+        if (!want(name)) continue;
+        auto rb = std::make_unique<RecvBuffer>(&pool);
+        uint32_t seq = 1000;
+        rb->setIRS(seq);
+        out.push_back(measure(opts, name, chunk, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                if (!rb->availableData())
+                {
+                    // refill outside the dequeue path as cheaply as possible
+                    size_t fill = rb->getWindowSize() / chunk * chunk;
+                    rb->enqueue(payload.data(), fill, seq, TCPFlag::ACK);
+                    seq += fill;
+                }
+                ssize_t r = rb->dequeue(sink.data(), chunk);
+                doNotOptimize(r);
+            }
+        }));
+    }
+}
+
+void sendBufferCases(const Options& opts, std::vector<Result>& out, const std::function<bool(const std::string&)>& want)
+{
+    constexpr size_t MSS = 1460;
+    std::vector<std::byte> payload(65536, std::byte{0x5a});
+    const SocketAddr local(IPAddr(ntohl(inet_addr("10.0.0.1"))), 40000);
+    const SocketAddr peer(IPAddr(ntohl(inet_addr("10.0.0.2"))), 40001);
+
+    // the sender's ISS is fixed at 100 and no SYN is in flight here
+    struct Sender {
+        std::unique_ptr<TCPEngine> engine_;
+        std::unique_ptr<RecvBuffer> rb_;
+        std::unique_ptr<SendBuffer> sb_;
+        uint32_t una_ = 100;
+
+        Sender(const SocketAddr& local, const SocketAddr& peer) : engine_(nullEngine()), rb_(std::make_unique<RecvBuffer>())
+        {
+            sb_ = std::make_unique<SendBuffer>(*engine_, *rb_);
+            sb_->setLocalAddr(local);
+            sb_->setPeerAddr(peer);
+            sb_->setRcvWnd(65535);
+        }
+
+        size_t inFlight() const
+        {
+            TCPInfo info{};
+            sb_->fillInfo(info);
+            return info.bytes_in_flight_;
+        }
+
+        // acks per ack_bytes, returns the number of handleACK calls
+        size_t ackAll(size_t ack_bytes)
+        {
+            size_t calls = 0, f;
+            while ((f = inFlight()) > 0)
+            {
+                una_ += std::min(f, ack_bytes);
+                sb_->handleACK(una_, std::chrono::steady_clock::now());
+                calls++;
+            }
+            return calls;
+        }
+    };
+
+    if (want("sendbuffer/enqueue/1460"))
+    {
+        Sender s(local, peer);
+        out.push_back(measure(opts, "sendbuffer/enqueue/1460", MSS, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                if (s.sb_->writable() < MSS) s.ackAll(65535);
+                s.sb_->enqueue(payload.data(), MSS, TCPFlag::PSH | TCPFlag::ACK);
+            }
+        }));
+    }
+
+    // a bulk writer: one ring-sized write per op, acked in one go; with
+    // EngineOptions::gso_ it is queued and acked as one super-segment
+    if (want("sendbuffer/enqueue/65536"))
+    {
+        Sender s(local, peer);
+        const size_t chunk = s.sb_->capacity();
+        out.push_back(measure(opts, "sendbuffer/enqueue/65536", chunk, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                s.sb_->enqueue(payload.data(), chunk, TCPFlag::PSH | TCPFlag::ACK);
+                s.ackAll(chunk);
+            }
+        }));
+    }
+
+    // fill the ring, then ack it back in delayed-ACK sized steps; each ack
+    // releases ring space and may send the next segments the window allows
+    if (want("sendbuffer/handleACK/2xMSS"))
+    {
+        Sender s(local, peer);
+        out.push_back(measure(opts, "sendbuffer/handleACK/2xMSS", 2 * MSS, [&](uint64_t n) {
+            uint64_t done = 0;
+            while (done < n)
+            {
+                if (s.inFlight() == 0) s.sb_->enqueue(payload.data(), s.sb_->writable(), TCPFlag::PSH | TCPFlag::ACK);
+                if (s.inFlight() == 0) break;
+                s.una_ += std::min(s.inFlight(), 2 * MSS);
+                s.sb_->handleACK(s.una_, std::chrono::steady_clock::now());
+                done++;
+            }
+        }));
+    }
+
+    // one segment from a connection's header template to the device: the
+    // per-segment TX cost without any SendBuffer bookkeeping
+    for (size_t sz : {size_t(0), MSS})
+    {
+        std::string name = "engine/send/" + std::to_string(sz);
+        if (!want(name)) continue;
+        auto engine = nullEngine();
+        PacketTemplate tmpl;
+        engine->initTemplate(tmpl, local, peer);
+        TCPSegment seg(payload.data(), payload.data(), 100, sz, sz, TCPFlag::PSH | TCPFlag::ACK);
+        out.push_back(measure(opts, name, sz, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                seg.seq_start_ += sz;
+                engine->send(seg, tmpl, 1000, 65535);
+            }
+        }));
+    }
+}
+
+void usage()
+{
+    std::cerr << "usage: ustack_microbench [--filter SUBSTR] [--min-time SECONDS] [--json]" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        if (a == "--filter" && i + 1 < argc) opts.filter_ = argv[++i];
+        else if (a == "--min-time" && i + 1 < argc) opts.min_time_ = std::stod(argv[++i]);
+        else if (a == "--json") opts.json_ = true;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    auto want = [&](const std::string& name) {
+        return opts.filter_.empty() || name.find(opts.filter_) != std::string::npos;
+    };
+
+    std::vector<Result> results;
+    checksumCases(opts, results, want);
+    headerCases(opts, results, want);
+    coalescerCases(opts, results, want);
+    recvBufferCases(opts, results, want);
+    sendBufferCases(opts, results, want);
+
+    if (opts.json_)
+    {
+        std::ostringstream js;
+        js << "[";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const auto& r = results[i];
+            js << (i ? "," : "") << "{\"name\":\"" << r.name_ << "\",\"ops\":" << r.ops_
+               << ",\"ns_per_op\":" << r.ns_per_op_ << ",\"bytes_per_s\":" << r.bytes_per_s_
+               << ",\"allocs_per_op\":" << r.allocs_per_op_ << "}";
+        }
+        js << "]";
+        std::cout << js.str() << std::endl;
+        return 0;
+    }
+    std::cout << std::left << std::setw(36) << "benchmark" << std::right << std::setw(12) << "ns/op"
+              << std::setw(14) << "MB/s" << std::setw(12) << "allocs/op" << std::endl;
+    for (const auto& r : results)
+    {
+        std::cout << std::left << std::setw(36) << r.name_ << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << r.ns_per_op_ << std::setw(14);
+        if (r.bytes_per_s_ > 0) std::cout << r.bytes_per_s_ / 1e6;
+        else std::cout << "-";
+        std::cout << std::setw(12) << r.allocs_per_op_ << std::endl;
+    }
+    return 0;
+}